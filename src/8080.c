@@ -0,0 +1,1660 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080.h"
+#include "debug.h"
+#include "hash.h"
+#include "hle.h"
+#include "metrics.h"
+
+ConditionCodes CC_ZSPAC = {1, 1, 1, 0, 1};
+
+const uint8_t cycles8080[256] = {
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x00
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x10
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, // 0x20
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, // 0x30
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x40
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x50
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x60
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, // 0x70
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x80
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x90
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xa0
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xb0
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // 0xc0
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // 0xd0
+     5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, // 0xe0
+     5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, // 0xf0
+};
+
+const OpInfo opcodes8080[256] = {
+    {"NOP", "", OPERAND_NONE, 1}, // 0x00
+    {"LXI", "B", OPERAND_D16, 3}, // 0x01
+    {"STAX", "B", OPERAND_NONE, 1}, // 0x02
+    {"INX", "B", OPERAND_NONE, 1}, // 0x03
+    {"INR", "B", OPERAND_NONE, 1}, // 0x04
+    {"DCR", "B", OPERAND_NONE, 1}, // 0x05
+    {"MVI", "B", OPERAND_D8, 2}, // 0x06
+    {"RLC", "", OPERAND_NONE, 1}, // 0x07
+    {NULL, "", OPERAND_NONE, 1}, // 0x08
+    {"DAD", "B", OPERAND_NONE, 1}, // 0x09
+    {"LDAX", "B", OPERAND_NONE, 1}, // 0x0a
+    {"DCX", "B", OPERAND_NONE, 1}, // 0x0b
+    {"INR", "C", OPERAND_NONE, 1}, // 0x0c
+    {"DCR", "C", OPERAND_NONE, 1}, // 0x0d
+    {"MVI", "C", OPERAND_D8, 2}, // 0x0e
+    {"RRC", "", OPERAND_NONE, 1}, // 0x0f
+    {NULL, "", OPERAND_NONE, 1}, // 0x10
+    {"LXI", "D", OPERAND_D16, 3}, // 0x11
+    {"STAX", "D", OPERAND_NONE, 1}, // 0x12
+    {"INX", "D", OPERAND_NONE, 1}, // 0x13
+    {"INR", "D", OPERAND_NONE, 1}, // 0x14
+    {"DCR", "D", OPERAND_NONE, 1}, // 0x15
+    {"MVI", "D", OPERAND_D8, 2}, // 0x16
+    {"RAL", "", OPERAND_NONE, 1}, // 0x17
+    {NULL, "", OPERAND_NONE, 1}, // 0x18
+    {"DAD", "D", OPERAND_NONE, 1}, // 0x19
+    {"LDAX", "D", OPERAND_NONE, 1}, // 0x1a
+    {"DCX", "D", OPERAND_NONE, 1}, // 0x1b
+    {"INR", "E", OPERAND_NONE, 1}, // 0x1c
+    {"DCR", "E", OPERAND_NONE, 1}, // 0x1d
+    {"MVI", "E", OPERAND_D8, 2}, // 0x1e
+    {"RAR", "", OPERAND_NONE, 1}, // 0x1f
+    {NULL, "", OPERAND_NONE, 1}, // 0x20
+    {"LXI", "H", OPERAND_D16, 3}, // 0x21
+    {"SHLD", "", OPERAND_ADDR, 3}, // 0x22
+    {"INX", "H", OPERAND_NONE, 1}, // 0x23
+    {"INR", "H", OPERAND_NONE, 1}, // 0x24
+    {"DCR", "H", OPERAND_NONE, 1}, // 0x25
+    {"MVI", "H", OPERAND_D8, 2}, // 0x26
+    {"DAA", "", OPERAND_NONE, 1}, // 0x27
+    {NULL, "", OPERAND_NONE, 1}, // 0x28
+    {"DAD", "H", OPERAND_NONE, 1}, // 0x29
+    {"LHLD", "", OPERAND_ADDR, 3}, // 0x2a
+    {"DCX", "H", OPERAND_NONE, 1}, // 0x2b
+    {"INR", "L", OPERAND_NONE, 1}, // 0x2c
+    {"DCR", "L", OPERAND_NONE, 1}, // 0x2d
+    {"MVI", "L", OPERAND_D8, 2}, // 0x2e
+    {"CMA", "", OPERAND_NONE, 1}, // 0x2f
+    {NULL, "", OPERAND_NONE, 1}, // 0x30
+    {"LXI", "SP", OPERAND_D16, 3}, // 0x31
+    {"STA", "", OPERAND_ADDR, 3}, // 0x32
+    {"INX", "SP", OPERAND_NONE, 1}, // 0x33
+    {"INR", "M", OPERAND_NONE, 1}, // 0x34
+    {"DCR", "M", OPERAND_NONE, 1}, // 0x35
+    {"MVI", "M", OPERAND_D8, 2}, // 0x36
+    {"STC", "", OPERAND_NONE, 1}, // 0x37
+    {NULL, "", OPERAND_NONE, 1}, // 0x38
+    {"DAD", "SP", OPERAND_NONE, 1}, // 0x39
+    {"LDA", "", OPERAND_ADDR, 3}, // 0x3a
+    {"DCX", "SP", OPERAND_NONE, 1}, // 0x3b
+    {"INR", "A", OPERAND_NONE, 1}, // 0x3c
+    {"DCR", "A", OPERAND_NONE, 1}, // 0x3d
+    {"MVI", "A", OPERAND_D8, 2}, // 0x3e
+    {"CMC", "", OPERAND_NONE, 1}, // 0x3f
+    {"MOV", "B,B", OPERAND_NONE, 1}, // 0x40
+    {"MOV", "B,C", OPERAND_NONE, 1}, // 0x41
+    {"MOV", "B,D", OPERAND_NONE, 1}, // 0x42
+    {"MOV", "B,E", OPERAND_NONE, 1}, // 0x43
+    {"MOV", "B,H", OPERAND_NONE, 1}, // 0x44
+    {"MOV", "B,L", OPERAND_NONE, 1}, // 0x45
+    {"MOV", "B,M", OPERAND_NONE, 1}, // 0x46
+    {"MOV", "B,A", OPERAND_NONE, 1}, // 0x47
+    {"MOV", "C,B", OPERAND_NONE, 1}, // 0x48
+    {"MOV", "C,C", OPERAND_NONE, 1}, // 0x49
+    {"MOV", "C,D", OPERAND_NONE, 1}, // 0x4a
+    {"MOV", "C,E", OPERAND_NONE, 1}, // 0x4b
+    {"MOV", "C,H", OPERAND_NONE, 1}, // 0x4c
+    {"MOV", "C,L", OPERAND_NONE, 1}, // 0x4d
+    {"MOV", "C,M", OPERAND_NONE, 1}, // 0x4e
+    {"MOV", "C,A", OPERAND_NONE, 1}, // 0x4f
+    {"MOV", "D,B", OPERAND_NONE, 1}, // 0x50
+    {"MOV", "D,C", OPERAND_NONE, 1}, // 0x51
+    {"MOV", "D,D", OPERAND_NONE, 1}, // 0x52
+    {"MOV", "D,E", OPERAND_NONE, 1}, // 0x53
+    {"MOV", "D,H", OPERAND_NONE, 1}, // 0x54
+    {"MOV", "D,L", OPERAND_NONE, 1}, // 0x55
+    {"MOV", "D,M", OPERAND_NONE, 1}, // 0x56
+    {"MOV", "D,A", OPERAND_NONE, 1}, // 0x57
+    {"MOV", "E,B", OPERAND_NONE, 1}, // 0x58
+    {"MOV", "E,C", OPERAND_NONE, 1}, // 0x59
+    {"MOV", "E,D", OPERAND_NONE, 1}, // 0x5a
+    {"MOV", "E,E", OPERAND_NONE, 1}, // 0x5b
+    {"MOV", "E,H", OPERAND_NONE, 1}, // 0x5c
+    {"MOV", "E,L", OPERAND_NONE, 1}, // 0x5d
+    {"MOV", "E,M", OPERAND_NONE, 1}, // 0x5e
+    {"MOV", "E,A", OPERAND_NONE, 1}, // 0x5f
+    {"MOV", "H,B", OPERAND_NONE, 1}, // 0x60
+    {"MOV", "H,C", OPERAND_NONE, 1}, // 0x61
+    {"MOV", "H,D", OPERAND_NONE, 1}, // 0x62
+    {"MOV", "H,E", OPERAND_NONE, 1}, // 0x63
+    {"MOV", "H,H", OPERAND_NONE, 1}, // 0x64
+    {"MOV", "H,L", OPERAND_NONE, 1}, // 0x65
+    {"MOV", "H,M", OPERAND_NONE, 1}, // 0x66
+    {"MOV", "H,A", OPERAND_NONE, 1}, // 0x67
+    {"MOV", "L,B", OPERAND_NONE, 1}, // 0x68
+    {"MOV", "L,C", OPERAND_NONE, 1}, // 0x69
+    {"MOV", "L,D", OPERAND_NONE, 1}, // 0x6a
+    {"MOV", "L,E", OPERAND_NONE, 1}, // 0x6b
+    {"MOV", "L,H", OPERAND_NONE, 1}, // 0x6c
+    {"MOV", "L,L", OPERAND_NONE, 1}, // 0x6d
+    {"MOV", "L,M", OPERAND_NONE, 1}, // 0x6e
+    {"MOV", "L,A", OPERAND_NONE, 1}, // 0x6f
+    {"MOV", "M,B", OPERAND_NONE, 1}, // 0x70
+    {"MOV", "M,C", OPERAND_NONE, 1}, // 0x71
+    {"MOV", "M,D", OPERAND_NONE, 1}, // 0x72
+    {"MOV", "M,E", OPERAND_NONE, 1}, // 0x73
+    {"MOV", "M,H", OPERAND_NONE, 1}, // 0x74
+    {"MOV", "M,L", OPERAND_NONE, 1}, // 0x75
+    {"HLT", "", OPERAND_NONE, 1}, // 0x76
+    {"MOV", "M,A", OPERAND_NONE, 1}, // 0x77
+    {"MOV", "A,B", OPERAND_NONE, 1}, // 0x78
+    {"MOV", "A,C", OPERAND_NONE, 1}, // 0x79
+    {"MOV", "A,D", OPERAND_NONE, 1}, // 0x7a
+    {"MOV", "A,E", OPERAND_NONE, 1}, // 0x7b
+    {"MOV", "A,H", OPERAND_NONE, 1}, // 0x7c
+    {"MOV", "A,L", OPERAND_NONE, 1}, // 0x7d
+    {"MOV", "A,M", OPERAND_NONE, 1}, // 0x7e
+    {"MOV", "A,A", OPERAND_NONE, 1}, // 0x7f
+    {"ADD", "B", OPERAND_NONE, 1}, // 0x80
+    {"ADD", "C", OPERAND_NONE, 1}, // 0x81
+    {"ADD", "D", OPERAND_NONE, 1}, // 0x82
+    {"ADD", "E", OPERAND_NONE, 1}, // 0x83
+    {"ADD", "H", OPERAND_NONE, 1}, // 0x84
+    {"ADD", "L", OPERAND_NONE, 1}, // 0x85
+    {"ADD", "M", OPERAND_NONE, 1}, // 0x86
+    {"ADD", "A", OPERAND_NONE, 1}, // 0x87
+    {"ADC", "B", OPERAND_NONE, 1}, // 0x88
+    {"ADC", "C", OPERAND_NONE, 1}, // 0x89
+    {"ADC", "D", OPERAND_NONE, 1}, // 0x8a
+    {"ADC", "E", OPERAND_NONE, 1}, // 0x8b
+    {"ADC", "H", OPERAND_NONE, 1}, // 0x8c
+    {"ADC", "L", OPERAND_NONE, 1}, // 0x8d
+    {"ADC", "M", OPERAND_NONE, 1}, // 0x8e
+    {"ADC", "A", OPERAND_NONE, 1}, // 0x8f
+    {"SUB", "B", OPERAND_NONE, 1}, // 0x90
+    {"SUB", "C", OPERAND_NONE, 1}, // 0x91
+    {"SUB", "D", OPERAND_NONE, 1}, // 0x92
+    {"SUB", "E", OPERAND_NONE, 1}, // 0x93
+    {"SUB", "H", OPERAND_NONE, 1}, // 0x94
+    {"SUB", "L", OPERAND_NONE, 1}, // 0x95
+    {"SUB", "M", OPERAND_NONE, 1}, // 0x96
+    {"SUB", "A", OPERAND_NONE, 1}, // 0x97
+    {"SBB", "B", OPERAND_NONE, 1}, // 0x98
+    {"SBB", "C", OPERAND_NONE, 1}, // 0x99
+    {"SBB", "D", OPERAND_NONE, 1}, // 0x9a
+    {"SBB", "E", OPERAND_NONE, 1}, // 0x9b
+    {"SBB", "H", OPERAND_NONE, 1}, // 0x9c
+    {"SBB", "L", OPERAND_NONE, 1}, // 0x9d
+    {"SBB", "M", OPERAND_NONE, 1}, // 0x9e
+    {"SBB", "A", OPERAND_NONE, 1}, // 0x9f
+    {"ANA", "B", OPERAND_NONE, 1}, // 0xa0
+    {"ANA", "C", OPERAND_NONE, 1}, // 0xa1
+    {"ANA", "D", OPERAND_NONE, 1}, // 0xa2
+    {"ANA", "E", OPERAND_NONE, 1}, // 0xa3
+    {"ANA", "H", OPERAND_NONE, 1}, // 0xa4
+    {"ANA", "L", OPERAND_NONE, 1}, // 0xa5
+    {"ANA", "M", OPERAND_NONE, 1}, // 0xa6
+    {"ANA", "A", OPERAND_NONE, 1}, // 0xa7
+    {"XRA", "B", OPERAND_NONE, 1}, // 0xa8
+    {"XRA", "C", OPERAND_NONE, 1}, // 0xa9
+    {"XRA", "D", OPERAND_NONE, 1}, // 0xaa
+    {"XRA", "E", OPERAND_NONE, 1}, // 0xab
+    {"XRA", "H", OPERAND_NONE, 1}, // 0xac
+    {"XRA", "L", OPERAND_NONE, 1}, // 0xad
+    {"XRA", "M", OPERAND_NONE, 1}, // 0xae
+    {"XRA", "A", OPERAND_NONE, 1}, // 0xaf
+    {"ORA", "B", OPERAND_NONE, 1}, // 0xb0
+    {"ORA", "C", OPERAND_NONE, 1}, // 0xb1
+    {"ORA", "D", OPERAND_NONE, 1}, // 0xb2
+    {"ORA", "E", OPERAND_NONE, 1}, // 0xb3
+    {"ORA", "H", OPERAND_NONE, 1}, // 0xb4
+    {"ORA", "L", OPERAND_NONE, 1}, // 0xb5
+    {"ORA", "M", OPERAND_NONE, 1}, // 0xb6
+    {"ORA", "A", OPERAND_NONE, 1}, // 0xb7
+    {"CMP", "B", OPERAND_NONE, 1}, // 0xb8
+    {"CMP", "C", OPERAND_NONE, 1}, // 0xb9
+    {"CMP", "D", OPERAND_NONE, 1}, // 0xba
+    {"CMP", "E", OPERAND_NONE, 1}, // 0xbb
+    {"CMP", "H", OPERAND_NONE, 1}, // 0xbc
+    {"CMP", "L", OPERAND_NONE, 1}, // 0xbd
+    {"CMP", "M", OPERAND_NONE, 1}, // 0xbe
+    {"CMP", "A", OPERAND_NONE, 1}, // 0xbf
+    {"RNZ", "", OPERAND_NONE, 1}, // 0xc0
+    {"POP", "B", OPERAND_NONE, 1}, // 0xc1
+    {"JNZ", "", OPERAND_ADDR, 3}, // 0xc2
+    {"JMP", "", OPERAND_ADDR, 3}, // 0xc3
+    {"CNZ", "", OPERAND_ADDR, 3}, // 0xc4
+    {"PUSH", "B", OPERAND_NONE, 1}, // 0xc5
+    {"ADI", "", OPERAND_D8, 2}, // 0xc6
+    {"RST", "0", OPERAND_NONE, 1}, // 0xc7
+    {"RZ", "", OPERAND_NONE, 1}, // 0xc8
+    {"RET", "", OPERAND_NONE, 1}, // 0xc9
+    {"JZ", "", OPERAND_ADDR, 3}, // 0xca
+    {NULL, "", OPERAND_NONE, 1}, // 0xcb
+    {"CZ", "", OPERAND_ADDR, 3}, // 0xcc
+    {"CALL", "", OPERAND_ADDR, 3}, // 0xcd
+    {"ACI", "", OPERAND_D8, 2}, // 0xce
+    {"RST", "1", OPERAND_NONE, 1}, // 0xcf
+    {"RNC", "", OPERAND_NONE, 1}, // 0xd0
+    {"POP", "D", OPERAND_NONE, 1}, // 0xd1
+    {"JNC", "", OPERAND_ADDR, 3}, // 0xd2
+    {"OUT", "", OPERAND_PORT, 2}, // 0xd3
+    {"CNC", "", OPERAND_ADDR, 3}, // 0xd4
+    {"PUSH", "D", OPERAND_NONE, 1}, // 0xd5
+    {"SUI", "", OPERAND_D8, 2}, // 0xd6
+    {"RST", "2", OPERAND_NONE, 1}, // 0xd7
+    {"RC", "", OPERAND_NONE, 1}, // 0xd8
+    {NULL, "", OPERAND_NONE, 1}, // 0xd9
+    {"JC", "", OPERAND_ADDR, 3}, // 0xda
+    {"IN", "", OPERAND_PORT, 2}, // 0xdb
+    {"CC", "", OPERAND_ADDR, 3}, // 0xdc
+    {NULL, "", OPERAND_NONE, 1}, // 0xdd
+    {"SBI", "", OPERAND_D8, 2}, // 0xde
+    {"RST", "3", OPERAND_NONE, 1}, // 0xdf
+    {"RPO", "", OPERAND_NONE, 1}, // 0xe0
+    {"POP", "H", OPERAND_NONE, 1}, // 0xe1
+    {"JPO", "", OPERAND_ADDR, 3}, // 0xe2
+    {"XTHL", "", OPERAND_NONE, 1}, // 0xe3
+    {"CPO", "", OPERAND_ADDR, 3}, // 0xe4
+    {"PUSH", "H", OPERAND_NONE, 1}, // 0xe5
+    {"ANI", "", OPERAND_D8, 2}, // 0xe6
+    {"RST", "4", OPERAND_NONE, 1}, // 0xe7
+    {"RPE", "", OPERAND_NONE, 1}, // 0xe8
+    {"PCHL", "", OPERAND_NONE, 1}, // 0xe9
+    {"JPE", "", OPERAND_ADDR, 3}, // 0xea
+    {"XCHG", "", OPERAND_NONE, 1}, // 0xeb
+    {"CPE", "", OPERAND_ADDR, 3}, // 0xec
+    {NULL, "", OPERAND_NONE, 1}, // 0xed
+    {"XRI", "", OPERAND_D8, 2}, // 0xee
+    {"RST", "5", OPERAND_NONE, 1}, // 0xef
+    {"RP", "", OPERAND_NONE, 1}, // 0xf0
+    {"POP", "PSW", OPERAND_NONE, 1}, // 0xf1
+    {"JP", "", OPERAND_ADDR, 3}, // 0xf2
+    {"DI", "", OPERAND_NONE, 1}, // 0xf3
+    {"CP", "", OPERAND_ADDR, 3}, // 0xf4
+    {"PUSH", "PSW", OPERAND_NONE, 1}, // 0xf5
+    {"ORI", "", OPERAND_D8, 2}, // 0xf6
+    {"RST", "6", OPERAND_NONE, 1}, // 0xf7
+    {"RM", "", OPERAND_NONE, 1}, // 0xf8
+    {"SPHL", "", OPERAND_NONE, 1}, // 0xf9
+    {"JM", "", OPERAND_ADDR, 3}, // 0xfa
+    {"EI", "", OPERAND_NONE, 1}, // 0xfb
+    {"CM", "", OPERAND_ADDR, 3}, // 0xfc
+    {NULL, "", OPERAND_NONE, 1}, // 0xfd
+    {"CPI", "", OPERAND_D8, 2}, // 0xfe
+    {"RST", "7", OPERAND_NONE, 1}, // 0xff
+};
+
+void unimplementedInstruction(State* state) {
+    if (state->metrics)
+        counterAdd(&state->metrics->unimplemented[state->memory[(uint16_t) (state->pc - 1)]], 1);
+    printf("Unimplemented instruction\n");
+    exit(1);
+}
+
+int parity(int x, int size) {
+    int i;
+    int p = 0;
+    x = (x & ((1 << size) - 1));
+    for (i = 0; i < size; i++) {
+        if (x & 0x1) p++;
+        x = x >> 1;
+    }
+    return (0 == (p & 0x1));
+}
+
+void logicFlagsA(State *state) {
+    state->cc.cy = state->cc.ac = 0;
+    state->cc.z = (state->a == 0);
+    state->cc.s = (0x80 == (state->a & 0x80));
+    state->cc.p = parity(state->a, 8);
+}
+
+void arithFlagsA(State *state, uint16_t res) {
+    state->cc.cy = (res > 0xff);
+    state->cc.z = ((res & 0xff) == 0);
+    state->cc.s = (0x80 == (res & 0x80));
+    state->cc.p = parity(res & 0xff, 8);
+}
+
+void flagsZSP(State *state, uint8_t value) {
+    state->cc.z = (value == 0);
+    state->cc.s = (0x80 == (value & 0x80));
+    state->cc.p = parity(value, 8);
+}
+
+uint8_t inr(State *state, uint8_t value) {
+    uint8_t res = value + 1;
+    state->cc.ac = ((res & 0x0f) == 0);
+    flagsZSP(state, res);
+    return res;
+}
+
+uint8_t dcr(State *state, uint8_t value) {
+    uint8_t res = value - 1;
+    state->cc.ac = ((res & 0x0f) != 0x0f);
+    flagsZSP(state, res);
+    return res;
+}
+
+void addA(State *state, uint8_t value, uint8_t carry) {
+    uint16_t res = (uint16_t) state->a + (uint16_t) value + carry;
+    state->cc.ac = (((state->a & 0x0f) + (value & 0x0f) + carry) > 0x0f);
+    arithFlagsA(state, res);
+    state->a = res & 0xff;
+}
+
+void subA(State *state, uint8_t value, uint8_t borrow) {
+    uint16_t res = (uint16_t) state->a - (uint16_t) value - borrow;
+    state->cc.ac = (((state->a & 0x0f) - (value & 0x0f) - borrow) >= 0);
+    arithFlagsA(state, res);
+    state->a = res & 0xff;
+}
+
+void cmpA(State *state, uint8_t value) {
+    uint8_t a = state->a;
+    subA(state, value, 0);
+    state->a = a;
+}
+
+static inline uint8_t readByte(State *state, uint16_t addr) {
+    uint8_t *page = state->read_map[addr >> 8];
+    if (page)
+        return page[addr & 0xff];
+    return memorySlowRead(state, addr);
+}
+
+static inline void writeByte(State *state, uint16_t addr, uint8_t value) {
+    uint8_t *page = state->write_map[addr >> 8];
+    if (page) {
+        // a fast page holds no trap, so the byte there is the old value
+        if (state->hash)
+            hashWrite(state->hash, addr, page[addr & 0xff], value);
+        page[addr & 0xff] = value;
+    } else
+        memorySlowWrite(state, addr, value);
+}
+
+// point every page either at memory (fast path) or at NULL when a debugger
+// or an HLE trap needs to see accesses to it
+void mapPages(State* state) {
+    int page;
+    for (page = 0; page < 256; page++) {
+        uint8_t flags = state->debug ? state->debug->page_flags[page] : 0;
+        uint8_t *base = &state->memory[page << 8];
+        int hle = state->hle && state->hle->pages[page];
+        state->read_map[page] = (hle || (flags & (PAGE_WATCH_READ | PAGE_BREAKPOINT))) ? NULL : base;
+        state->write_map[page] = (hle || (flags & (PAGE_WATCH_WRITE | PAGE_BREAKPOINT))) ? NULL : base;
+    }
+}
+
+// HLE traps sit underneath breakpoints, so this goes last
+static uint8_t hleOriginal(State* state, uint16_t addr, uint8_t value) {
+    int i = state->hle ? hleIndex(state, addr) : -1;
+    return i >= 0 ? state->hle->saved[i] : value;
+}
+
+uint8_t memorySlowRead(State* state, uint16_t addr) {
+    uint8_t value = state->debug ? debugRead(state, addr) : state->memory[addr];
+    return hleOriginal(state, addr, value);
+}
+
+void memorySlowWrite(State* state, uint16_t addr, uint8_t value) {
+    int hle = state->hle ? hleIndex(state, addr) : -1;
+    if (state->hash)
+        hashWrite(state->hash, addr, memoryPeek(state, addr), value);
+    if (hle >= 0)
+        state->hle->saved[hle] = value;
+    else if (state->debug)
+        debugWrite(state, addr, value);
+    else
+        state->memory[addr] = value;
+}
+
+// memory as the program sees it, without breakpoint traps or side effects
+uint8_t memoryPeek(State* state, uint16_t addr) {
+    const Breakpoint *bp = state->debug ? breakpointAt(state, addr) : NULL;
+    return hleOriginal(state, addr, bp ? bp->saved : state->memory[addr]);
+}
+
+uint8_t memoryRead(State* state, uint16_t addr) {
+    return readByte(state, addr);
+}
+
+void memoryWrite(State* state, uint16_t addr, uint8_t value) {
+    writeByte(state, addr, value);
+}
+
+// CRC-32 of len bytes from addr, used to identify ROM images
+uint32_t memoryChecksum(State* state, uint16_t addr, uint32_t len) {
+    static uint32_t table[256];
+    uint32_t crc = 0xffffffff;
+    uint32_t i;
+    if (table[1] == 0) {
+        for (i = 0; i < 256; i++) {
+            uint32_t c = i;
+            int k;
+            for (k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    for (i = 0; i < len; i++)
+        crc = table[(crc ^ memoryPeek(state, addr + i)) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void push(State *state, uint8_t hi, uint8_t lo) {
+    writeByte(state, state->sp-1, hi);
+    writeByte(state, state->sp-2, lo);
+    state->sp = state->sp - 2;
+}
+
+uint16_t pop(State *state) {
+    uint16_t value = readByte(state, state->sp) | (readByte(state, state->sp+1) << 8);
+    state->sp += 2;
+    return value;
+}
+
+int Emulate8080(State* state) {
+
+    unsigned char *opcode = &state->memory[state->pc];
+    int cycles = cycles8080[*opcode];
+    int stop = STOP_NONE;
+
+    state->pc += 1;
+
+    switch(*opcode) {
+        case 0x00: break; // NOP
+        case 0x01:        // LXI    B,word
+                state->c = opcode[1];
+                state->b = opcode[2];
+                state->pc += 2; // advance 2 bytes
+                break;
+        case 0x02: // STAX B
+                {
+                uint16_t offset = (state->b << 8) | state->c;
+                writeByte(state, offset, state->a);
+                }
+                break;
+        case 0x03: // INX B
+                state->c++;
+                if (state->c == 0)
+                    state->b++;
+                break;
+        case 0x04: state->b = inr(state, state->b); break; // INR B
+        case 0x05: state->b = dcr(state, state->b); break; // DCR B
+        case 0x06: // MVI B,byte
+                state->b = opcode[1];
+                state->pc++;
+                break;
+        case 0x07: // RLC
+                {
+                    uint8_t x = state->a;
+                    state->a = ((x & 0x80) >> 7) | (x << 1);
+                    state->cc.cy = (0x80 == (x & 0x80));
+                }
+                break;
+        case 0x08: unimplementedInstruction(state); break;
+        case 0x09: // DAD B
+                {
+                    uint32_t hl = (state->h << 8) | state->l;
+                    uint32_t bc = (state->b << 8) | state->c;
+                    uint32_t res = hl + bc;
+                    state->h = (res & 0xff00) >> 8;
+                    state->l = res & 0xff;
+                    state->cc.cy = ((res & 0xffff0000) > 0);
+                }
+                break;
+        case 0x0a: // LDAX B
+                {
+                uint16_t offset = (state->b << 8) | state->c;
+                state->a = readByte(state, offset);
+                }
+                break;
+        case 0x0b: // DCX B
+                state->c--;
+                if (state->c == 0xff)
+                    state->b--;
+                break;
+        case 0x0c: state->c = inr(state, state->c); break; // INR C
+        case 0x0d: state->c = dcr(state, state->c); break; // DCR C
+        case 0x0e: //MVI C, byte
+                state->c = opcode[1];
+                state->pc++;
+                break;
+        case 0x0f: //RRC
+                {
+                    uint8_t x = state->a;
+                    state->a = ((x & 1) << 7) | (x >> 1);
+                    state->cc.cy = (1 == (x & 1));
+                }
+                break;
+        case 0x10: unimplementedInstruction(state); break;
+        case 0x11: //LXI D,word
+                state->e = opcode[1];
+                state->d = opcode[2];
+                state->pc += 2;
+                break;
+        case 0x12: // STAX D
+                {
+                uint16_t offset = (state->d << 8) | state->e;
+                writeByte(state, offset, state->a);
+                }
+                break;
+        case 0x13: //INX D
+                state->e++;
+                if (state->e == 0)
+                    state->d++;
+                break;
+        case 0x14: state->d = inr(state, state->d); break; // INR D
+        case 0x15: state->d = dcr(state, state->d); break; // DCR D
+        case 0x16: // MVI D,byte
+                state->d = opcode[1];
+                state->pc++;
+                break;
+        case 0x17: // RAL
+                {
+                    uint8_t x = state->a;
+                    state->a = (x << 1) | state->cc.cy;
+                    state->cc.cy = (0x80 == (x & 0x80));
+                }
+                break;
+        case 0x18: unimplementedInstruction(state); break;
+        case 0x19: // DAD D
+                {
+                uint32_t hl = (state->h << 8) | state->l;
+                uint32_t de = (state->d << 8) | state->e;
+                uint32_t res = hl + de;
+                state->h = (res & 0xff00) >> 8;
+                state->l = res & 0xff;
+                state->cc.cy = ((res & 0xffff0000) != 0);
+                }
+                break;
+        case 0x1a: // LDAX D
+                {
+                uint16_t offset = (state->d << 8) | state->e;
+                state->a = readByte(state, offset);
+                }
+                break;
+        case 0x1b: // DCX D
+                state->e--;
+                if (state->e == 0xff)
+                    state->d--;
+                break;
+        case 0x1c: state->e = inr(state, state->e); break; // INR E
+        case 0x1d: state->e = dcr(state, state->e); break; // DCR E
+        case 0x1e: // MVI E,byte
+                state->e = opcode[1];
+                state->pc++;
+                break;
+        case 0x1f: // RAR
+                {
+                    uint8_t x = state->a;
+                    state->a = (state->cc.cy << 7) | (x >> 1);
+                    state->cc.cy = (1 == (x & 1));
+                }
+                break;
+        case 0x20: unimplementedInstruction(state); break;
+        case 0x21:          // LXI    H,word
+                state->l = opcode[1];
+                state->h = opcode[2];
+                state->pc += 2;
+                break;
+        case 0x22:        // SHLD   (word)
+                {
+                uint16_t offset = (opcode[2] << 8) | (opcode[1]);
+                writeByte(state, offset, state->l);
+                writeByte(state, (uint16_t) (offset+1), state->h);
+                state->pc += 2;
+                }
+                break;
+        case 0x23:        // INX    H
+                state->l++;
+                if (state->l == 0)
+                    state->h++;
+                break;
+        case 0x24: state->h = inr(state, state->h); break; // INR H
+        case 0x25: state->h = dcr(state, state->h); break; // DCR H
+        case 0x26:        // MVI H,byte
+                state->h = opcode[1];
+                state->pc++;
+                break;
+        case 0x27: // DAA
+                {
+                    uint8_t lsb = state->a & 0x0f;
+                    uint8_t msb = state->a >> 4;
+                    uint8_t correction = 0;
+                    if (lsb > 9 || state->cc.ac)
+                        correction |= 0x06;
+                    if (msb > 9 || state->cc.cy || (msb >= 9 && lsb > 9)) {
+                        correction |= 0x60;
+                        state->cc.cy = 1;
+                    }
+                    state->cc.ac = ((lsb + (correction & 0x0f)) > 0x0f);
+                    state->a += correction;
+                    flagsZSP(state, state->a);
+                }
+                break;
+        case 0x28: unimplementedInstruction(state); break;
+        case 0x29:        // DAD    H
+                {
+                uint32_t hl = (state->h << 8) | state->l;
+                uint32_t res = hl + hl;
+                state->h = (res & 0xff00) >> 8;
+                state->l = res & 0xff;
+                state->cc.cy = ((res & 0xffff0000) != 0);
+                }
+                break;
+        case 0x2a:        // LHLD   (word)
+                {
+                uint16_t offset = (opcode[2] << 8) | (opcode[1]);
+                state->l = readByte(state, offset);
+                state->h = readByte(state, (uint16_t) (offset+1));
+                state->pc += 2;
+                }
+                break;
+        case 0x2b:        // DCX    H
+                state->l--;
+                if (state->l == 0xff)
+                    state->h--;
+                break;
+        case 0x2c: state->l = inr(state, state->l); break; // INR L
+        case 0x2d: state->l = dcr(state, state->l); break; // DCR L
+        case 0x2e:        // MVI L,byte
+                state->l = opcode[1];
+                state->pc++;
+                break;
+        case 0x2f: state->a = ~state->a; break; // CMA
+        case 0x30: unimplementedInstruction(state); break;
+        case 0x31:        // LXI    SP,word
+                state->sp = (opcode[2] << 8) | opcode[1];
+                state->pc += 2;
+                break;
+        case 0x32:        // STA    (word)
+                {
+                uint16_t offset = (opcode[2] << 8) | (opcode[1]);
+                writeByte(state, offset, state->a);
+                state->pc += 2;
+                }
+                break;
+        case 0x33: state->sp++; break; // INX SP
+        case 0x34: // INR M
+                {
+                uint16_t offset = (state->h<<8) | (state->l);
+                writeByte(state, offset, inr(state, readByte(state, offset)));
+                }
+                break;
+        case 0x35: // DCR M
+                {
+                uint16_t offset = (state->h<<8) | (state->l);
+                writeByte(state, offset, dcr(state, readByte(state, offset)));
+                }
+                break;
+        case 0x36: // MVI M,byte
+                {
+                uint16_t offset = (state->h<<8) | (state->l);
+                writeByte(state, offset, opcode[1]);
+                state->pc++;
+                }
+                break;
+        case 0x37: state->cc.cy = 1; break; // STC
+        case 0x38: unimplementedInstruction(state); break;
+        case 0x39: // DAD SP
+                {
+                uint32_t hl = (state->h << 8) | state->l;
+                uint32_t res = hl + state->sp;
+                state->h = (res & 0xff00) >> 8;
+                state->l = res & 0xff;
+                state->cc.cy = ((res & 0xffff0000) != 0);
+                }
+                break;
+        case 0x3a:        // LDA    (word)
+                {
+                uint16_t offset = (opcode[2] << 8) | (opcode[1]);
+                state->a = readByte(state, offset);
+                state->pc += 2;
+                }
+                break;
+        case 0x3b: state->sp--; break; // DCX SP
+        case 0x3c: state->a = inr(state, state->a); break; // INR A
+        case 0x3d: state->a = dcr(state, state->a); break; // DCR A
+        case 0x3e: // MVI A,byte
+                state->a = opcode[1];
+                state->pc++;
+                break;
+        case 0x3f: state->cc.cy = !state->cc.cy; break; // CMC
+        case 0x40: state->b = state->b; break; // MOV B,B
+        case 0x41: state->b = state->c; break; // MOV B,C
+        case 0x42: state->b = state->d; break; // MOV B,D
+        case 0x43: state->b = state->e; break; // MOV B,E
+        case 0x44: state->b = state->h; break; // MOV B,H
+        case 0x45: state->b = state->l; break; // MOV B,L
+        case 0x46: // MOV B,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->b = readByte(state, offset);
+                   }
+                   break;
+        case 0x47: state->b = state->a; break; // MOV B,A
+        case 0x48: state->c = state->b; break; // MOV C,B
+        case 0x49: state->c = state->c; break; // MOV C,C
+        case 0x4a: state->c = state->d; break; // MOV C,D
+        case 0x4b: state->c = state->e; break; // MOV C,E
+        case 0x4c: state->c = state->h; break; // MOV C,H
+        case 0x4d: state->c = state->l; break; // MOV C,L
+        case 0x4e: // MOV C,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->c = readByte(state, offset);
+                   }
+                   break;
+        case 0x4f: state->c = state->a; break; // MOV C,A
+        case 0x50: state->d = state->b; break; // MOV D,B
+        case 0x51: state->d = state->c; break; // MOV D,C
+        case 0x52: state->d = state->d; break; // MOV D,D
+        case 0x53: state->d = state->e; break; // MOV D,E
+        case 0x54: state->d = state->h; break; // MOV D,H
+        case 0x55: state->d = state->l; break; // MOV D,L
+        case 0x56: // MOV D,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->d = readByte(state, offset);
+                   }
+                   break;
+        case 0x57: state->d = state->a; break; // MOV D,A
+        case 0x58: state->e = state->b; break; // MOV E,B
+        case 0x59: state->e = state->c; break; // MOV E,C
+        case 0x5a: state->e = state->d; break; // MOV E,D
+        case 0x5b: state->e = state->e; break; // MOV E,E
+        case 0x5c: state->e = state->h; break; // MOV E,H
+        case 0x5d: state->e = state->l; break; // MOV E,L
+        case 0x5e: // MOV E,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->e = readByte(state, offset);
+                   }
+                   break;
+        case 0x5f: state->e = state->a; break; // MOV E,A
+        case 0x60: state->h = state->b; break; // MOV H,B
+        case 0x61: state->h = state->c; break; // MOV H,C
+        case 0x62: state->h = state->d; break; // MOV H,D
+        case 0x63: state->h = state->e; break; // MOV H,E
+        case 0x64: state->h = state->h; break; // MOV H,H
+        case 0x65: state->h = state->l; break; // MOV H,L
+        case 0x66: // MOV H,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->h = readByte(state, offset);
+                   }
+                   break;
+        case 0x67: state->h = state->a; break; // MOV H,A
+        case 0x68: state->l = state->b; break; // MOV L,B
+        case 0x69: state->l = state->c; break; // MOV L,C
+        case 0x6a: state->l = state->d; break; // MOV L,D
+        case 0x6b: state->l = state->e; break; // MOV L,E
+        case 0x6c: state->l = state->h; break; // MOV L,H
+        case 0x6d: state->l = state->l; break; // MOV L,L
+        case 0x6e: // MOV L,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->l = readByte(state, offset);
+                   }
+                   break;
+        case 0x6f: state->l = state->a; break; // MOV L,A
+        case 0x70: // MOV M,B
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->b);
+                   }
+                   break;
+        case 0x71: // MOV M,C
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->c);
+                   }
+                   break;
+        case 0x72: // MOV M,D
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->d);
+                   }
+                   break;
+        case 0x73: // MOV M,E
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->e);
+                   }
+                   break;
+        case 0x74: // MOV M,H
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->h);
+                   }
+                   break;
+        case 0x75: // MOV M,L
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->l);
+                   }
+                   break;
+        case 0x76: stop = STOP_HALT; break; // HLT
+        case 0x77: // MOV M,A
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    writeByte(state, offset, state->a);
+                   }
+                   break;
+        case 0x78: state->a = state->b; break; // MOV A,B
+        case 0x79: state->a = state->c; break; // MOV A,C
+        case 0x7a: state->a = state->d; break; // MOV A,D
+        case 0x7b: state->a = state->e; break; // MOV A,E
+        case 0x7c: state->a = state->h; break; // MOV A,H
+        case 0x7d: state->a = state->l; break; // MOV A,L
+        case 0x7e: // MOV A,M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->a = readByte(state, offset);
+                   }
+                   break;
+        case 0x7f: state->a = state->a; break; // MOV A,A
+        case 0x80: addA(state, state->b, 0); break; // ADD B
+        case 0x81: addA(state, state->c, 0); break; // ADD C
+        case 0x82: addA(state, state->d, 0); break; // ADD D
+        case 0x83: addA(state, state->e, 0); break; // ADD E
+        case 0x84: addA(state, state->h, 0); break; // ADD H
+        case 0x85: addA(state, state->l, 0); break; // ADD L
+        case 0x86: // ADD M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    addA(state, readByte(state, offset), 0);
+                   }
+                   break;
+        case 0x87: addA(state, state->a, 0); break; // ADD A
+        case 0x88: addA(state, state->b, state->cc.cy); break; // ADC B
+        case 0x89: addA(state, state->c, state->cc.cy); break; // ADC C
+        case 0x8a: addA(state, state->d, state->cc.cy); break; // ADC D
+        case 0x8b: addA(state, state->e, state->cc.cy); break; // ADC E
+        case 0x8c: addA(state, state->h, state->cc.cy); break; // ADC H
+        case 0x8d: addA(state, state->l, state->cc.cy); break; // ADC L
+        case 0x8e: // ADC M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    addA(state, readByte(state, offset), state->cc.cy);
+                   }
+                   break;
+        case 0x8f: addA(state, state->a, state->cc.cy); break; // ADC A
+        case 0x90: subA(state, state->b, 0); break; // SUB B
+        case 0x91: subA(state, state->c, 0); break; // SUB C
+        case 0x92: subA(state, state->d, 0); break; // SUB D
+        case 0x93: subA(state, state->e, 0); break; // SUB E
+        case 0x94: subA(state, state->h, 0); break; // SUB H
+        case 0x95: subA(state, state->l, 0); break; // SUB L
+        case 0x96: // SUB M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    subA(state, readByte(state, offset), 0);
+                   }
+                   break;
+        case 0x97: subA(state, state->a, 0); break; // SUB A
+        case 0x98: subA(state, state->b, state->cc.cy); break; // SBB B
+        case 0x99: subA(state, state->c, state->cc.cy); break; // SBB C
+        case 0x9a: subA(state, state->d, state->cc.cy); break; // SBB D
+        case 0x9b: subA(state, state->e, state->cc.cy); break; // SBB E
+        case 0x9c: subA(state, state->h, state->cc.cy); break; // SBB H
+        case 0x9d: subA(state, state->l, state->cc.cy); break; // SBB L
+        case 0x9e: // SBB M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    subA(state, readByte(state, offset), state->cc.cy);
+                   }
+                   break;
+        case 0x9f: subA(state, state->a, state->cc.cy); break; // SBB A
+        case 0xa0: // ANA B
+                   {
+                    state->a = state->a & state->b;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa1: // ANA C
+                   {
+                    state->a = state->a & state->c;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa2: // ANA D
+                   {
+                    state->a = state->a & state->d;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa3: // ANA E
+                   {
+                    state->a = state->a & state->e;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa4: // ANA H
+                   {
+                    state->a = state->a & state->h;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa5: // ANA L
+                   {
+                    state->a = state->a & state->l;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa6: // ANA M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->a = state->a & readByte(state, offset);
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa7: // ANA A
+                   {
+                    state->a = state->a & state->a;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa8: // XRA B
+                   {
+                    state->a = state->a ^ state->b;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xa9: // XRA C
+                   {
+                    state->a = state->a ^ state->c;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xaa: // XRA D
+                   {
+                    state->a = state->a ^ state->d;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xab: // XRA E
+                   {
+                    state->a = state->a ^ state->e;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xac: // XRA H
+                   {
+                    state->a = state->a ^ state->h;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xad: // XRA L
+                   {
+                    state->a = state->a ^ state->l;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xae: // XRA M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->a = state->a ^ readByte(state, offset);
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xaf: // XRA A
+                   {
+                    state->a = state->a ^ state->a;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb0: // ORA B
+                   {
+                    state->a = state->a | state->b;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb1: // ORA C
+                   {
+                    state->a = state->a | state->c;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb2: // ORA D
+                   {
+                    state->a = state->a | state->d;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb3: // ORA E
+                   {
+                    state->a = state->a | state->e;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb4: // ORA H
+                   {
+                    state->a = state->a | state->h;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb5: // ORA L
+                   {
+                    state->a = state->a | state->l;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb6: // ORA M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    state->a = state->a | readByte(state, offset);
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb7: // ORA A
+                   {
+                    state->a = state->a | state->a;
+                    logicFlagsA(state);
+                   }
+                   break;
+        case 0xb8: cmpA(state, state->b); break; // CMP B
+        case 0xb9: cmpA(state, state->c); break; // CMP C
+        case 0xba: cmpA(state, state->d); break; // CMP D
+        case 0xbb: cmpA(state, state->e); break; // CMP E
+        case 0xbc: cmpA(state, state->h); break; // CMP H
+        case 0xbd: cmpA(state, state->l); break; // CMP L
+        case 0xbe: // CMP M
+                   {
+                    uint16_t offset = (state->h<<8) | (state->l);
+                    cmpA(state, readByte(state, offset));
+                   }
+                   break;
+        case 0xbf: cmpA(state, state->a); break; // CMP A
+        case 0xc0: // RNZ
+                   {
+                    if (0 == state->cc.z) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xc1: // POP B
+                   {
+                    state->c = readByte(state, state->sp);
+                    state->b = readByte(state, state->sp+1);
+                    state->sp += 2;
+                   }
+                   break;
+        case 0xc2: // JNZ addr
+                   {
+                    if (0 == state->cc.z)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xc3: // JMP addr
+                   {
+                    state->pc = (opcode[2] << 8) | opcode[1];
+                   }
+                   break;
+        case 0xc4: // CNZ addr
+                   {
+                    if (0 == state->cc.z) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xc5: // PUSH B
+                   {
+                    push(state, state->b, state->c);
+                   }
+                   break;
+        case 0xc6: // ADI byte
+                   {
+                    addA(state, opcode[1], 0);
+                    state->pc++;
+                   }
+                   break;
+        case 0xc7: // RST 0
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x00;
+                   }
+                   break;
+        case 0xc8: // RZ
+                   {
+                    if (1 == state->cc.z) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xc9: // RET
+                   {
+                    state->pc = pop(state);
+                   }
+                   break;
+        case 0xca: // JZ addr
+                   {
+                    if (1 == state->cc.z)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xcb: unimplementedInstruction(state); break;
+        case 0xcc: // CZ addr
+                   {
+                    if (1 == state->cc.z) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xcd: // CALL addr
+                   {
+                    uint16_t ret = state->pc+2;
+                    push(state, (ret >> 8) & 0xff, ret & 0xff);
+                    state->pc = (opcode[2] << 8) | opcode[1];
+                   }
+                   break;
+        case 0xce: // ACI byte
+                   {
+                    addA(state, opcode[1], state->cc.cy);
+                    state->pc++;
+                   }
+                   break;
+        case 0xcf: // RST 1
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x08;
+                   }
+                   break;
+        case 0xd0: // RNC
+                   {
+                    if (0 == state->cc.cy) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xd1: // POP D
+                   {
+                    state->e = readByte(state, state->sp);
+                    state->d = readByte(state, state->sp+1);
+                    state->sp += 2;
+                   }
+                   break;
+        case 0xd2: // JNC addr
+                   {
+                    if (0 == state->cc.cy)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xd3: // OUT byte
+                   {
+                    if (state->out)
+                        state->out(state, opcode[1], state->a);
+                    if (state->metrics)
+                        counterAdd(&state->metrics->port_writes, 1);
+                    state->pc++;
+                   }
+                   break;
+        case 0xd4: // CNC addr
+                   {
+                    if (0 == state->cc.cy) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xd5: // PUSH D
+                   {
+                    push(state, state->d, state->e);
+                   }
+                   break;
+        case 0xd6: // SUI byte
+                   {
+                    subA(state, opcode[1], 0);
+                    state->pc++;
+                   }
+                   break;
+        case 0xd7: // RST 2
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x10;
+                   }
+                   break;
+        case 0xd8: // RC
+                   {
+                    if (1 == state->cc.cy) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xd9: unimplementedInstruction(state); break;
+        case 0xda: // JC addr
+                   {
+                    if (1 == state->cc.cy)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xdb: // IN byte
+                   {
+                    state->a = state->in ? state->in(state, opcode[1]) : 0;
+                    if (state->metrics)
+                        counterAdd(&state->metrics->port_reads, 1);
+                    state->pc++;
+                   }
+                   break;
+        case 0xdc: // CC addr
+                   {
+                    if (1 == state->cc.cy) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xdd: unimplementedInstruction(state); break;
+        case 0xde: // SBI byte
+                   {
+                    subA(state, opcode[1], state->cc.cy);
+                    state->pc++;
+                   }
+                   break;
+        case 0xdf: // RST 3
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x18;
+                   }
+                   break;
+        case 0xe0: // RPO
+                   {
+                    if (0 == state->cc.p) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xe1: // POP H
+                   {
+                    state->l = readByte(state, state->sp);
+                    state->h = readByte(state, state->sp+1);
+                    state->sp += 2;
+                   }
+                   break;
+        case 0xe2: // JPO addr
+                   {
+                    if (0 == state->cc.p)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xe3: // XTHL
+                   {
+                    uint8_t l = readByte(state, state->sp);
+                    uint8_t h = readByte(state, state->sp+1);
+                    writeByte(state, state->sp, state->l);
+                    writeByte(state, state->sp+1, state->h);
+                    state->l = l;
+                    state->h = h;
+                   }
+                   break;
+        case 0xe4: // CPO addr
+                   {
+                    if (0 == state->cc.p) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xe5: // PUSH H
+                   {
+                    push(state, state->h, state->l);
+                   }
+                   break;
+        case 0xe6: // ANI byte
+                   {
+                    state->a = state->a & opcode[1];
+                    logicFlagsA(state);
+                    state->pc++;
+                   }
+                   break;
+        case 0xe7: // RST 4
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x20;
+                   }
+                   break;
+        case 0xe8: // RPE
+                   {
+                    if (1 == state->cc.p) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xe9: // PCHL
+                   {
+                    state->pc = (state->h << 8) | state->l;
+                   }
+                   break;
+        case 0xea: // JPE addr
+                   {
+                    if (1 == state->cc.p)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xeb: // XCHG
+                   {
+                    uint8_t sv1 = state->d;
+                    uint8_t sv2 = state->e;
+                    state->d = state->h;
+                    state->e = state->l;
+                    state->h = sv1;
+                    state->l = sv2;
+                   }
+                   break;
+        case 0xec: // CPE addr
+                   {
+                    if (1 == state->cc.p) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xed: // TRAP_OPCODE
+                   {
+                    uint16_t addr = state->pc - 1;
+                    if (breakpointAt(state, addr)) {
+                        state->pc = addr;
+                        state->stop_addr = addr;
+                        cycles = 0;
+                        stop = STOP_BREAKPOINT;
+                    } else {
+                        unimplementedInstruction(state);
+                    }
+                   }
+                   break;
+        case 0xee: // XRI byte
+                   {
+                    state->a = state->a ^ opcode[1];
+                    logicFlagsA(state);
+                    state->pc++;
+                   }
+                   break;
+        case 0xef: // RST 5
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x28;
+                   }
+                   break;
+        case 0xf0: // RP
+                   {
+                    if (0 == state->cc.s) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xf1: // POP PSW
+                   {
+                    state->a = readByte(state, state->sp+1);
+                    uint8_t psw = readByte(state, state->sp);
+                    state->cc.z = (0x01 == (psw & 0x01));
+                    state->cc.s = (0x02 == (psw & 0x02));
+                    state->cc.p = (0x04 == (psw & 0x04));
+                    state->cc.cy = (0x08 == (psw & 0x08));
+                    state->cc.ac = (0x10 == (psw & 0x10));
+                    state->sp += 2;
+                   }
+                   break;
+        case 0xf2: // JP addr
+                   {
+                    if (0 == state->cc.s)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xf3: // DI
+                   {
+                    state->int_enable = 0;
+                   }
+                   break;
+        case 0xf4: // CP addr
+                   {
+                    if (0 == state->cc.s) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xf5: // PUSH PSW
+                   {
+                    uint8_t psw = (state->cc.z |
+                            state->cc.s << 1 |
+                            state->cc.p << 2 |
+                            state->cc.cy << 3 |
+                            state->cc.ac << 4);
+                    push(state, state->a, psw);
+                   }
+                   break;
+        case 0xf6: // ORI byte
+                   {
+                    state->a = state->a | opcode[1];
+                    logicFlagsA(state);
+                    state->pc++;
+                   }
+                   break;
+        case 0xf7: // RST 6
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x30;
+                   }
+                   break;
+        case 0xf8: // RM
+                   {
+                    if (1 == state->cc.s) {
+                        state->pc = pop(state);
+                        cycles += 6;
+                    }
+                   }
+                   break;
+        case 0xf9: // SPHL
+                   {
+                    state->sp = (state->h << 8) | state->l;
+                   }
+                   break;
+        case 0xfa: // JM addr
+                   {
+                    if (1 == state->cc.s)
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                    else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xfb: // EI
+                   {
+                    state->int_enable = 1;
+                   }
+                   break;
+        case 0xfc: // CM addr
+                   {
+                    if (1 == state->cc.s) {
+                        uint16_t ret = state->pc+2;
+                        push(state, (ret >> 8) & 0xff, ret & 0xff);
+                        state->pc = (opcode[2] << 8) | opcode[1];
+                        cycles += 6;
+                    } else
+                        state->pc += 2;
+                   }
+                   break;
+        case 0xfd: // HLE_OPCODE
+                   {
+                    int hook = hleIndex(state, state->pc - 1);
+                    if (hook < 0) {
+                        unimplementedInstruction(state);
+                        break;
+                    }
+                    int native = hleRun(state, hook);
+                    if (native < 0)
+                        return hleStep(state, hook);
+                    cycles = native;
+                   }
+                   break;
+        case 0xfe: // CPI byte
+                   {
+                    cmpA(state, opcode[1]);
+                    state->pc++;
+                   }
+                   break;
+        case 0xff: // RST 7
+                   {
+                    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+                    state->pc = 0x38;
+                   }
+                   break;
+    }
+    state->cycles += cycles;
+    if (state->metrics) {
+        counterAdd(&state->metrics->instructions, 1);
+        counterAdd(&state->metrics->cycles, cycles);
+    }
+    if (state->stop_reason != STOP_NONE) {
+        stop = state->stop_reason;
+        state->stop_reason = STOP_NONE;
+    }
+    if (stop != STOP_NONE)
+        state->stop_pc = (uint16_t) (opcode - state->memory);
+    if (state->trace) {
+        printf("\t");
+        printf("%c", state->cc.z ? 'z' : '.');
+        printf("%c", state->cc.s ? 's' : '.');
+        printf("%c", state->cc.p ? 'p' : '.');
+        printf("%c", state->cc.cy ? 'c' : '.');
+        printf("%c", state->cc.ac ? 'a' : '.');
+        printf("A $%02x B $%02x C $%02x D$%02x E $%02x H $%02x L $%02x SP %04x\n", state->a, state->b, state->c,
+                state->d, state->e, state->h, state->l, state->sp);
+    }
+    return stop;
+}
+
+// RST n from an external device; ignored while interrupts are disabled.
+// Returns 1 if it was taken.
+int generateInterrupt(State* state, int n) {
+    if (!state->int_enable) {
+        if (state->metrics)
+            counterAdd(&state->metrics->interrupts_masked, 1);
+        return 0;
+    }
+    push(state, (state->pc >> 8) & 0xff, state->pc & 0xff);
+    state->pc = 8 * n;
+    state->int_enable = 0;
+    state->cycles += cycles8080[0xc7 | n << 3];
+    if (state->metrics) {
+        counterAdd(&state->metrics->interrupts, 1);
+        counterAdd(&state->metrics->cycles, cycles8080[0xc7 | n << 3]);
+    }
+    return 1;
+}
+
+int formatInstruction(const unsigned char *buffer, int pc, char *out, size_t len) {
+    const unsigned char *code = &buffer[pc];
+    const OpInfo *info = &opcodes8080[*code];
+    uint8_t lo = buffer[(uint16_t) (pc + 1)];
+    uint8_t hi = buffer[(uint16_t) (pc + 2)];
+    char operand[8] = "";
+
+    if (info->mnemonic == NULL) {
+        snprintf(out, len, "%-6s $%02x", "DB", *code);
+        return 1;
+    }
+    switch (info->operand) {
+        case OPERAND_D8: snprintf(operand, sizeof(operand), "#$%02x", lo); break;
+        case OPERAND_D16: snprintf(operand, sizeof(operand), "#$%02x%02x", hi, lo); break;
+        case OPERAND_ADDR: snprintf(operand, sizeof(operand), "$%02x%02x", hi, lo); break;
+        case OPERAND_PORT: snprintf(operand, sizeof(operand), "$%02x", lo); break;
+    }
+    if (info->args[0] == 0 && operand[0] == 0)
+        snprintf(out, len, "%s", info->mnemonic);
+    else
+        snprintf(out, len, "%-6s %s%s%s", info->mnemonic, info->args,
+                info->args[0] && operand[0] ? "," : "", operand);
+    return info->bytes;
+}
+
+int dissassemble(unsigned char *buffer, int pc) {
+    char text[32];
+    int opbytes = formatInstruction(buffer, pc, text, sizeof(text));
+    printf("%04x %s\n", pc, text);
+    return opbytes;
+}
+
+void readFileToMemoryAt(State* state, char* filename, uint32_t offset) {
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        printf("error opening file: %s\n", filename);
+        exit(1);
+    }
+    fseek(f, 0L, SEEK_END);
+    int fsize = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+
+    uint8_t *buffer = &state->memory[offset];
+    fread(buffer, fsize, 1, f);
+    fclose(f);
+    if (state->hash)
+        hashReset(state);
+}
+
+State* init8080(void) {
+    State* state = calloc(1, sizeof(State));
+    state->memory = calloc(0x10000, 1); // 64k
+    mapPages(state);
+    return state;
+}
+
+void free8080(State* state) {
+    metricsDetach(state);
+    hleDisable(state);
+    free(state->debug);
+    free(state->hash);
+    free(state->scheduler);
+    free(state->memory);
+    free(state);
+}
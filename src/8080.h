@@ -0,0 +1,104 @@
+#ifndef SCL_8080_H
+#define SCL_8080_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ConditionCodes {
+    uint8_t z:1;
+    uint8_t s:1;
+    uint8_t p:1;
+    uint8_t cy:1;
+    uint8_t ac:1;
+    uint8_t pad:3;
+} ConditionCodes;
+
+typedef struct State State;
+typedef struct Debug Debug;
+typedef struct StateHash StateHash;
+typedef struct Metrics Metrics;
+typedef struct Hle Hle;
+typedef struct Scheduler Scheduler;
+
+typedef uint8_t (*PortIn)(State* state, uint8_t port);
+typedef void (*PortOut)(State* state, uint8_t port, uint8_t value);
+
+struct State {
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint16_t sp;
+    uint16_t pc;
+    uint8_t *memory;
+    struct ConditionCodes cc;
+    uint8_t int_enable;
+    uint8_t trace;
+    uint64_t cycles;
+    PortIn in;
+    PortOut out;
+    void *io;
+    uint8_t *read_map[256];     // page base for reads, NULL takes the slow path
+    uint8_t *write_map[256];
+    Debug *debug;
+    StateHash *hash;
+    Metrics *metrics;           // NULL unless counters are attached
+    Hle *hle;                   // native versions of ROM routines
+    Scheduler *scheduler;       // timed device events
+    int stop_reason;            // set by the slow paths, reported after the instruction
+    uint16_t stop_pc;
+    uint16_t stop_addr;
+};
+
+// reasons Emulate8080 asks the run loop to stop
+enum {
+    STOP_NONE = 0,
+    STOP_HALT,
+    STOP_BREAKPOINT,
+    STOP_WATCH_READ,
+    STOP_WATCH_WRITE,
+};
+
+// kind of immediate that follows an opcode
+enum {
+    OPERAND_NONE = 0,
+    OPERAND_D8,
+    OPERAND_D16,
+    OPERAND_ADDR,
+    OPERAND_PORT,
+};
+
+typedef struct OpInfo {
+    const char *mnemonic;   // NULL for undocumented opcodes
+    const char *args;       // fixed register operands, e.g. "B,C"
+    uint8_t operand;
+    uint8_t bytes;
+} OpInfo;
+
+// base cycle count per opcode; conditional CALL/RET add 6 when taken
+extern const uint8_t cycles8080[256];
+extern const OpInfo opcodes8080[256];
+
+State* init8080(void);
+void free8080(State* state);
+void mapPages(State* state);
+uint8_t memorySlowRead(State* state, uint16_t addr);
+void memorySlowWrite(State* state, uint16_t addr, uint8_t value);
+uint8_t memoryPeek(State* state, uint16_t addr);
+uint8_t memoryRead(State* state, uint16_t addr);
+void memoryWrite(State* state, uint16_t addr, uint8_t value);
+uint32_t memoryChecksum(State* state, uint16_t addr, uint32_t len);
+int Emulate8080(State* state);
+int generateInterrupt(State* state, int n);
+
+// flag helpers, shared with the native routines in hle.c
+uint8_t dcr(State *state, uint8_t value);
+void cmpA(State *state, uint8_t value);
+int formatInstruction(const unsigned char *buffer, int pc, char *out, size_t len);
+int dissassemble(unsigned char *buffer, int pc);
+void readFileToMemoryAt(State* state, char* filename, uint32_t offset);
+
+#endif
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+
+#define MIN_TABLE_WORDS 3
+#define MAX_SPECULATE 1024      // instructions checked before giving up on a seed
+#define MAX_NOP_RUN 3           // padding longer than this is taken as zero fill
+
+#define KNOWN (MAP_CODE | MAP_OPERAND | MAP_DATA | MAP_TABLE)
+
+typedef struct SeedCandidate {
+    uint16_t from;          // where the pointer word is
+    uint16_t to;
+    int length;             // instructions plausibleCode decoded from to
+} SeedCandidate;
+
+typedef struct Walker {
+    State *state;
+    Analysis *a;
+    uint8_t *visited;       // per routine, so every routine sees its own calls
+    uint16_t *work;         // block starts still to walk for this routine
+    int nwork;
+    uint16_t *entries;      // routines still to walk
+    int nentries;
+    int callcap;
+    int tablecap;
+    uint32_t *stamp;        // per candidate seed, so the check needs no clearing
+    uint32_t generation;
+    SeedCandidate *candidates;
+    int ncandidates;
+} Walker;
+
+static int inRom(const Analysis *a, uint32_t addr) {
+    return addr >= a->base && addr < a->base + a->size;
+}
+
+static void addEntry(Walker *w, uint16_t addr) {
+    Analysis *a = w->a;
+    if (!inRom(a, addr) || (a->map[addr - a->base] & MAP_ENTRY))
+        return;
+    a->map[addr - a->base] |= MAP_ENTRY | MAP_BLOCK;
+    a->nentries++;
+    w->entries[w->nentries++] = addr;
+}
+
+static void addBlock(Walker *w, uint32_t addr) {
+    Analysis *a = w->a;
+    if (!inRom(a, addr))
+        return;
+    a->map[addr - a->base] |= MAP_BLOCK;
+    if (!w->visited[addr - a->base])
+        w->work[w->nwork++] = addr;
+}
+
+static void addCall(Walker *w, uint16_t caller, uint16_t site, uint16_t callee) {
+    Analysis *a = w->a;
+    if (a->ncalls == w->callcap) {
+        w->callcap = w->callcap ? w->callcap * 2 : 256;
+        a->calls = realloc(a->calls, w->callcap * sizeof(CallEdge));
+    }
+    a->calls[a->ncalls].caller = caller;
+    a->calls[a->ncalls].site = site;
+    a->calls[a->ncalls].callee = callee;
+    a->ncalls++;
+    addEntry(w, callee);
+}
+
+static void addTable(Walker *w, uint16_t addr, uint16_t count) {
+    Analysis *a = w->a;
+    int i;
+    // routines sharing code reach the same PCHL
+    for (i = 0; i < a->ntables; i++) {
+        if (a->tables[i].addr == addr) {
+            if (count > a->tables[i].count)
+                a->tables[i].count = count;
+            return;
+        }
+    }
+    if (a->ntables == w->tablecap) {
+        w->tablecap = w->tablecap ? w->tablecap * 2 : 32;
+        a->tables = realloc(a->tables, w->tablecap * sizeof(JumpTable));
+    }
+    a->tables[a->ntables].addr = addr;
+    a->tables[a->ntables].count = count;
+    a->ntables++;
+}
+
+// a load from ROM proves the bytes it reads are data
+static void addData(Walker *w, uint32_t addr, int len) {
+    for (; len > 0; addr++, len--) {
+        if (inRom(w->a, addr))
+            w->a->map[addr - w->a->base] |= MAP_DATA;
+    }
+}
+
+// register pairs (1 = BC, 2 = DE, 4 = HL) an instruction overwrites
+static int clobbers(uint8_t op) {
+    if (op >= 0x40 && op < 0x80 && op != 0x76)                      // MOV r,x
+        return ((op >> 3) & 7) < 6 ? 1 << ((op >> 4) & 3) : 0;
+    if ((op & 0xc7) == 0x04 || (op & 0xc7) == 0x05 || (op & 0xc7) == 0x06)    // INR, DCR, MVI
+        return ((op >> 3) & 7) < 6 ? 1 << ((op >> 4) & 3) : 0;
+    if ((op & 0xcf) == 0xc1 && op != 0xf1)                          // POP B/D/H
+        return 1 << ((op >> 4) & 3);
+    if ((op & 0xcf) == 0x09 || op == 0x2a || op == 0xe3)            // DAD, LHLD, XTHL
+        return 4;
+    return 0;
+}
+
+// follow the LXI value in each pair while nothing else overwrites it; LDA,
+// LHLD, and LDAX or an M operand through a tracked pair mark the bytes read
+static void trackPointers(Walker *w, uint32_t *lxi, uint8_t op, uint16_t target) {
+    int pairs = clobbers(op);
+    int i;
+
+    if (op == 0x3a || op == 0x2a)
+        addData(w, target, op == 0x2a ? 2 : 1);
+    else if ((op == 0x0a || op == 0x1a) && lxi[op >> 4])
+        addData(w, lxi[op >> 4], 1);
+    else if (lxi[2] && (((op & 0xc7) == 0x46 && op != 0x76) || (op & 0xc7) == 0x86))
+        addData(w, lxi[2], 1);
+
+    if ((op & 0xcf) == 0x01 && op != 0x31) {                        // LXI B/D/H
+        lxi[op >> 4] = target;
+    } else if ((op & 0xcf) == 0x03 && op != 0x33 && lxi[op >> 4]) { // INX
+        lxi[op >> 4]++;
+    } else if ((op & 0xcf) == 0x0b && op != 0x3b && lxi[op >> 4]) { // DCX
+        lxi[op >> 4]--;
+    } else if (op == 0xeb) {                                        // XCHG
+        uint32_t t = lxi[1];
+        lxi[1] = lxi[2];
+        lxi[2] = t;
+    }
+    for (i = 0; i < 3; i++) {
+        if (pairs & (1 << i))
+            lxi[i] = 0;
+    }
+}
+
+// decode one block onwards from pc until control leaves it unconditionally
+static void walkBlock(Walker *w, uint16_t entry, uint32_t pc) {
+    Analysis *a = w->a;
+    uint32_t lxi[3] = {0, 0, 0};    // LXI B/D/H immediate still in the pair
+    uint32_t ret = 0x10000;         // return address pushed for a PCHL
+    while (inRom(a, pc) && !w->visited[pc - a->base]) {
+        uint8_t op = memoryPeek(w->state, pc);
+        const OpInfo *info = &opcodes8080[op];
+        uint16_t target;
+        int i;
+
+        // an undocumented opcode means we followed a path into data
+        if (info->mnemonic == NULL || !inRom(a, pc + info->bytes - 1))
+            return;
+        w->visited[pc - a->base] = 1;
+        a->map[pc - a->base] |= MAP_CODE;
+        for (i = 1; i < info->bytes; i++)
+            a->map[pc + i - a->base] |= MAP_OPERAND;
+        target = memoryPeek(w->state, pc + 1) | memoryPeek(w->state, pc + 2) << 8;
+        pc += info->bytes;
+
+        if ((op & 0xcf) == 0xc5 && op != 0xf5)              // PUSH B/D/H
+            ret = lxi[(op >> 4) & 3] ? lxi[(op >> 4) & 3] : ret;
+        else if (op == 0xe3)                                // XTHL
+            ret = lxi[2] ? lxi[2] : ret;
+        trackPointers(w, lxi, op, target);
+
+        if (op == 0xc3) {                                   // JMP
+            addBlock(w, target);
+            return;
+        } else if ((op & 0xc7) == 0xc2) {                   // Jcc
+            addBlock(w, target);
+            addBlock(w, pc);
+            return;
+        } else if (op == 0xcd || (op & 0xc7) == 0xc4) {     // CALL, Ccc
+            addCall(w, entry, pc - 3, target);
+        } else if ((op & 0xc7) == 0xc7) {                   // RST n
+            addCall(w, entry, pc - 1, op & 0x38);
+        } else if (op == 0xe9) {                            // PCHL
+            // LXI rp,ret; PUSH rp (or XTHL); ...; PCHL is an indirect call
+            addTable(w, pc - 1, 0);
+            addBlock(w, ret);
+            return;
+        } else if (op == 0xc9 || op == 0x76) {              // RET, HLT
+            return;
+        } else if ((op & 0xc7) == 0xc0) {                   // Rcc
+            addBlock(w, pc);
+            return;
+        }
+    }
+}
+
+// runs of words in data that all point at instructions; zero words and the
+// RST vectors are left out since they'd match any cleared table
+static void findTables(Walker *w) {
+    Analysis *a = w->a;
+    uint32_t addr = a->base;
+    while (addr + 1 < a->base + a->size) {
+        uint32_t end = addr;
+        while (end + 1 < a->base + a->size &&
+                !(a->map[end - a->base] & (MAP_CODE | MAP_OPERAND)) &&
+                !(a->map[end + 1 - a->base] & (MAP_CODE | MAP_OPERAND))) {
+            uint16_t word = memoryPeek(w->state, end) | memoryPeek(w->state, end + 1) << 8;
+            if (!inRom(a, word) || word - a->base < 0x40 || !(a->map[word - a->base] & MAP_CODE))
+                break;
+            end += 2;
+        }
+        if ((end - addr) / 2 >= MIN_TABLE_WORDS) {
+            uint32_t i;
+            addTable(w, addr, (end - addr) / 2);
+            for (i = addr; i < end; i++)
+                a->map[i - a->base] |= MAP_TABLE;
+            addr = end;
+        } else {
+            addr++;
+        }
+    }
+}
+
+// check that code at addr decodes cleanly along every path until each one
+// returns, jumps through PCHL or joins code already walked; returns the
+// number of new instructions decoded, or 0
+static int plausibleCode(Walker *w, uint32_t addr) {
+    Analysis *a = w->a;
+    int n = 0;
+
+    w->generation++;
+    w->nwork = 0;
+    w->work[w->nwork++] = addr;
+    while (w->nwork) {
+        uint32_t pc = w->work[--w->nwork];
+        int nop = 0;
+        for (;;) {
+            uint8_t op;
+            const OpInfo *info;
+            uint16_t target;
+            int i;
+
+            if (!inRom(a, pc) || (a->map[pc - a->base] & (MAP_OPERAND | MAP_DATA | MAP_TABLE)))
+                return 0;
+            if ((a->map[pc - a->base] & MAP_CODE) || w->stamp[pc - a->base] == w->generation)
+                break;
+            op = memoryPeek(w->state, pc);
+            info = &opcodes8080[op];
+            // zero fill decodes as NOPs, so a seed that starts with one or
+            // runs into more than a little padding is taken as data
+            nop = op == 0 ? nop + 1 : 0;
+            if (info->mnemonic == NULL || op == 0x76 || ++n > MAX_SPECULATE ||
+                    (nop && pc == addr) || nop > MAX_NOP_RUN)
+                return 0;
+            for (i = 1; i < info->bytes; i++) {
+                if (!inRom(a, pc + i) || (a->map[pc + i - a->base] & KNOWN))
+                    return 0;
+            }
+            w->stamp[pc - a->base] = w->generation;
+            target = memoryPeek(w->state, pc + 1) | memoryPeek(w->state, pc + 2) << 8;
+            pc += info->bytes;
+
+            if (op == 0xc3) {                                   // JMP
+                pc = target;
+            } else if ((op & 0xc7) == 0xc2 || op == 0xcd || (op & 0xc7) == 0xc4) {
+                w->work[w->nwork++] = target;                   // Jcc, CALL, Ccc
+            } else if (op == 0xc9 || op == 0xe9) {              // RET, PCHL
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+static void walkEntries(Walker *w) {
+    while (w->nentries) {
+        uint16_t entry = w->entries[--w->nentries];
+        memset(w->visited, 0, w->a->size);
+        // plausibleCode shares the stack and can give up part way
+        w->nwork = 0;
+        w->work[w->nwork++] = entry;
+        while (w->nwork)
+            walkBlock(w, entry, w->work[--w->nwork]);
+    }
+}
+
+// a word inside walked code can't be a seed, and one aimed at bytes already
+// classified has nothing to add; returns plausibleCode's count
+static int seedable(Walker *w, const SeedCandidate *c) {
+    const Analysis *a = w->a;
+    if (((a->map[c->from - a->base] | a->map[c->from + 1 - a->base]) & (MAP_CODE | MAP_OPERAND)) ||
+            (a->map[c->to - a->base] & KNOWN))
+        return 0;
+    return plausibleCode(w, c->to);
+}
+
+// longest decode first, then by address so the order is deterministic
+static int byLength(const void *x, const void *y) {
+    const SeedCandidate *a = x, *b = y;
+    if (a->length != b->length)
+        return b->length - a->length;
+    return a->from - b->from;
+}
+
+// Words outside walked code that point at unknown bytes which decode as
+// code are handlers reached through RAM (e.g. a table copied out at
+// startup). An entry into the middle of a real routine decodes a subset of
+// it, so the longest decodes are seeded first, and each is walked before
+// the next is checked again. Returns the number of routines seeded.
+static int seedEntries(Walker *w) {
+    Analysis *a = w->a;
+    uint32_t addr;
+    int i, seeds = 0;
+
+    w->ncandidates = 0;
+    for (addr = a->base; addr + 1 < a->base + a->size; addr++) {
+        SeedCandidate c;
+        c.from = addr;
+        c.to = memoryPeek(w->state, addr) | memoryPeek(w->state, addr + 1) << 8;
+        if (inRom(a, c.to) && c.to - a->base >= 0x40 && (c.length = seedable(w, &c)))
+            w->candidates[w->ncandidates++] = c;
+    }
+    qsort(w->candidates, w->ncandidates, sizeof(SeedCandidate), byLength);
+
+    for (i = 0; i < w->ncandidates; i++) {
+        if (seedable(w, &w->candidates[i])) {
+            addEntry(w, w->candidates[i].to);
+            walkEntries(w);
+            seeds++;
+        }
+    }
+    return seeds;
+}
+
+void analyseRom(State* state, uint16_t base, uint32_t size, Analysis *analysis) {
+    Walker w;
+    uint32_t i;
+    int n;
+
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->base = base;
+    analysis->size = size;
+    analysis->rom_checksum = memoryChecksum(state, base, size);
+    analysis->map = calloc(size, 1);
+
+    memset(&w, 0, sizeof(w));
+    w.state = state;
+    w.a = analysis;
+    w.visited = calloc(size, 1);
+    w.stamp = calloc(size, sizeof(uint32_t));
+    // at most two pushes per instruction walked
+    w.work = malloc(2 * size * sizeof(uint16_t));
+    w.entries = malloc(size * sizeof(uint16_t));
+    w.candidates = malloc(size * sizeof(SeedCandidate));
+
+    for (n = 0; n < 8; n++)
+        addEntry(&w, n * 8);
+    walkEntries(&w);
+    // new code can complete a table or expose more pointers, so repeat
+    // until a round finds no new routines
+    do {
+        findTables(&w);
+    } while (seedEntries(&w));
+
+    for (i = 0; i < size; i++) {
+        // a branch into the middle of an instruction doesn't start a block,
+        // and code reached after a load or table guess overrides it
+        if ((analysis->map[i] & MAP_BLOCK) && !(analysis->map[i] & MAP_CODE))
+            analysis->map[i] &= ~MAP_BLOCK;
+        if (analysis->map[i] & (MAP_CODE | MAP_OPERAND))
+            analysis->map[i] &= ~(MAP_DATA | MAP_TABLE);
+        if (analysis->map[i] & MAP_BLOCK)
+            analysis->nblocks++;
+    }
+    free(w.visited);
+    free(w.stamp);
+    free(w.work);
+    free(w.entries);
+    free(w.candidates);
+}
+
+void analysisFree(Analysis *analysis) {
+    free(analysis->map);
+    free(analysis->calls);
+    free(analysis->tables);
+    memset(analysis, 0, sizeof(*analysis));
+}
+
+// header, then map[size], calls[ncalls], tables[ntables]
+typedef struct AnalysisHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t base;
+    uint32_t size;
+    uint32_t rom_checksum;
+    uint32_t ncalls;
+    uint32_t ntables;
+    uint32_t nblocks;
+    uint32_t nentries;
+} AnalysisHeader;
+
+int saveAnalysis(const Analysis *analysis, const char *filename, char *err, size_t errlen) {
+    AnalysisHeader header;
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        snprintf(err, errlen, "error opening file: %s", filename);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ANALYSIS_MAGIC, 4);
+    header.version = ANALYSIS_VERSION;
+    header.base = analysis->base;
+    header.size = analysis->size;
+    header.rom_checksum = analysis->rom_checksum;
+    header.ncalls = analysis->ncalls;
+    header.ntables = analysis->ntables;
+    header.nblocks = analysis->nblocks;
+    header.nentries = analysis->nentries;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(analysis->map, 1, analysis->size, f);
+    fwrite(analysis->calls, sizeof(CallEdge), analysis->ncalls, f);
+    fwrite(analysis->tables, sizeof(JumpTable), analysis->ntables, f);
+    if (ferror(f) | fclose(f)) {
+        snprintf(err, errlen, "error writing file: %s", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int loadAnalysis(State* state, const char *filename, Analysis *analysis, char *err, size_t errlen) {
+    AnalysisHeader header;
+    long file_size;
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        snprintf(err, errlen, "error opening file: %s", filename);
+        return -1;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (file_size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        snprintf(err, errlen, "error reading file: %s", filename);
+        fclose(f);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, ANALYSIS_MAGIC, 4) != 0) {
+        snprintf(err, errlen, "not an analysis cache");
+        fclose(f);
+        return -1;
+    }
+    if (header.version != ANALYSIS_VERSION) {
+        snprintf(err, errlen, "unsupported analysis cache version %d (expected %d)",
+                header.version, ANALYSIS_VERSION);
+        fclose(f);
+        return -1;
+    }
+    if (header.base + header.size > 0x10000 ||
+            memoryChecksum(state, header.base, header.size) != header.rom_checksum) {
+        snprintf(err, errlen, "analysis cache was built from a different ROM");
+        fclose(f);
+        return -1;
+    }
+    // the counts size the allocations, so they have to fit in the file
+    if ((uint64_t) sizeof(header) + header.size + (uint64_t) header.ncalls * sizeof(CallEdge) +
+            (uint64_t) header.ntables * sizeof(JumpTable) > (uint64_t) file_size) {
+        snprintf(err, errlen, "truncated analysis cache");
+        fclose(f);
+        return -1;
+    }
+
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->base = header.base;
+    analysis->size = header.size;
+    analysis->rom_checksum = header.rom_checksum;
+    analysis->ncalls = header.ncalls;
+    analysis->ntables = header.ntables;
+    analysis->nblocks = header.nblocks;
+    analysis->nentries = header.nentries;
+    analysis->map = malloc(header.size);
+    analysis->calls = malloc(header.ncalls * sizeof(CallEdge) + 1);
+    analysis->tables = malloc(header.ntables * sizeof(JumpTable) + 1);
+    if (fread(analysis->map, 1, header.size, f) != header.size ||
+            fread(analysis->calls, sizeof(CallEdge), header.ncalls, f) != header.ncalls ||
+            fread(analysis->tables, sizeof(JumpTable), header.ntables, f) != header.ntables) {
+        snprintf(err, errlen, "truncated analysis cache");
+        analysisFree(analysis);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
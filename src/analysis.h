@@ -0,0 +1,58 @@
+#ifndef SCL_ANALYSIS_H
+#define SCL_ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "8080.h"
+
+#define ANALYSIS_MAGIC "SCLA"
+#define ANALYSIS_VERSION 2
+
+// per-byte flags in Analysis.map; a byte is code if it has CODE or OPERAND,
+// data if it has DATA or TABLE, and unknown if it has none of them
+enum {
+    MAP_CODE = 0x01,        // first byte of an instruction
+    MAP_OPERAND = 0x02,     // operand byte of an instruction
+    MAP_BLOCK = 0x04,       // starts a basic block
+    MAP_ENTRY = 0x08,       // reset/RST vector, call target or seeded pointer
+    MAP_TABLE = 0x10,       // inside a jump-table candidate
+    MAP_DATA = 0x20,        // read by a load the walk followed
+};
+
+typedef struct CallEdge {
+    uint16_t caller;        // entry of the calling routine
+    uint16_t site;          // address of the CALL/RST
+    uint16_t callee;
+} CallEdge;
+
+// a PCHL site (count 0), or a run of words in data that all point at code
+typedef struct JumpTable {
+    uint16_t addr;
+    uint16_t count;
+} JumpTable;
+
+typedef struct Analysis {
+    uint32_t rom_checksum;
+    uint16_t base;
+    uint32_t size;
+    uint8_t *map;           // size entries, indexed by addr - base
+    CallEdge *calls;
+    int ncalls;
+    JumpTable *tables;
+    int ntables;
+    int nblocks;
+    int nentries;
+} Analysis;
+
+// follow control flow from the reset and RST vectors over [base, base+size),
+// then from words in unwalked bytes that point at plausible code, until
+// nothing new turns up
+void analyseRom(State* state, uint16_t base, uint32_t size, Analysis *analysis);
+void analysisFree(Analysis *analysis);
+
+// the cache is only accepted if it was built from the same ROM image
+int saveAnalysis(const Analysis *analysis, const char *filename, char *err, size_t errlen);
+int loadAnalysis(State* state, const char *filename, Analysis *analysis, char *err, size_t errlen);
+
+#endif
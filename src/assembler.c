@@ -0,0 +1,626 @@
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "assembler.h"
+#include "debug.h"
+#include "hash.h"
+#include "hle.h"
+
+#define ASM_LINE_MAX 256
+#define MAX_OPERANDS 16
+
+typedef struct Assembler {
+    State *state;
+    Symbols *symbols;
+    int pass;
+    uint16_t pc;
+    uint16_t insnStart;
+    int line;
+    int32_t end;        // highest address reached, for the span assemble() returns
+    int strict;         // forward references are errors even in pass 1
+    const char *p;      // expression cursor
+    char *err;
+    size_t errlen;
+    jmp_buf fail;
+} Assembler;
+
+static void asmError(Assembler *as, const char *fmt, ...) {
+    va_list ap;
+    int n = snprintf(as->err, as->errlen, "line %d: ", as->line);
+    va_start(ap, fmt);
+    if (n >= 0 && (size_t) n < as->errlen)
+        vsnprintf(as->err + n, as->errlen - n, fmt, ap);
+    va_end(ap);
+    longjmp(as->fail, 1);
+}
+
+static uint32_t hashName(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (uint8_t) *name++) * 16777619u;
+    return h;
+}
+
+static Symbol *findSlot(Symbol *table, int cap, const char *name) {
+    uint32_t i = hashName(name) & (cap - 1);
+    while (table[i].name[0] && strcmp(table[i].name, name) != 0)
+        i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+static Symbol *intern(Symbols *symbols, const char *name) {
+    if ((symbols->count + 1) * 2 > symbols->cap) {
+        int cap = symbols->cap ? symbols->cap * 2 : 64;
+        Symbol *table = calloc(cap, sizeof(Symbol));
+        int i;
+        for (i = 0; i < symbols->cap; i++) {
+            if (symbols->table[i].name[0])
+                *findSlot(table, cap, symbols->table[i].name) = symbols->table[i];
+        }
+        free(symbols->table);
+        free(symbols->byAddress);
+        symbols->table = table;
+        symbols->cap = cap;
+        symbols->byAddress = malloc(cap * sizeof(int));
+    }
+    Symbol *sym = findSlot(symbols->table, symbols->cap, name);
+    if (sym->name[0] == 0) {
+        strcpy(sym->name, name);
+        symbols->count++;
+    }
+    return sym;
+}
+
+const Symbol *symbolLookup(const Symbols *symbols, const char *name) {
+    if (symbols->cap == 0)
+        return NULL;
+    const Symbol *sym = findSlot(symbols->table, symbols->cap, name);
+    return sym->name[0] && sym->defined ? sym : NULL;
+}
+
+// nearest label at or below addr
+const Symbol *symbolFor(const Symbols *symbols, uint16_t addr, uint16_t *offset) {
+    int lo = 0, hi = symbols->labels - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols->table[symbols->byAddress[mid]].value <= addr) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (found < 0)
+        return NULL;
+    const Symbol *sym = &symbols->table[symbols->byAddress[found]];
+    if (offset)
+        *offset = addr - sym->value;
+    return sym;
+}
+
+void symbolsClear(Symbols *symbols) {
+    if (symbols->table)
+        memset(symbols->table, 0, symbols->cap * sizeof(Symbol));
+    symbols->count = 0;
+    symbols->labels = 0;
+}
+
+void symbolsFree(Symbols *symbols) {
+    free(symbols->table);
+    free(symbols->byAddress);
+    memset(symbols, 0, sizeof(*symbols));
+}
+
+static const Symbols *sortSymbols;
+
+static int byValue(const void *x, const void *y) {
+    const Symbol *a = &sortSymbols->table[*(const int *) x];
+    const Symbol *b = &sortSymbols->table[*(const int *) y];
+    if (a->value != b->value)
+        return a->value - b->value;
+    return strcmp(a->name, b->name);
+}
+
+static void indexLabels(Symbols *symbols) {
+    int i;
+    symbols->labels = 0;
+    for (i = 0; i < symbols->cap; i++) {
+        if (symbols->table[i].name[0] && symbols->table[i].label && symbols->table[i].defined)
+            symbols->byAddress[symbols->labels++] = i;
+    }
+    sortSymbols = symbols;
+    qsort(symbols->byAddress, symbols->labels, sizeof(int), byValue);
+}
+
+static void skipSpace(Assembler *as) {
+    while (*as->p == ' ' || *as->p == '\t')
+        as->p++;
+}
+
+static int isIdentStart(int c) {
+    return isalpha(c) || c == '_' || c == '.' || c == '@';
+}
+
+static int isIdentChar(int c) {
+    return isalnum(c) || c == '_' || c == '.' || c == '@';
+}
+
+static int hexValue(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = toupper(c);
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int32_t number(Assembler *as) {
+    const char *p = as->p;
+    int32_t v = 0;
+
+    if (*p == '$') {
+        p++;
+        while (hexValue(*p) >= 0)
+            v = v * 16 + hexValue(*p++);
+    } else if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        p += 2;
+        while (hexValue(*p) >= 0)
+            v = v * 16 + hexValue(*p++);
+    } else {
+        // decimal, or hex with an H suffix such as 0FFH
+        const char *q = p;
+        while (hexValue(*q) >= 0)
+            q++;
+        if (*q == 'h' || *q == 'H') {
+            while (p < q)
+                v = v * 16 + hexValue(*p++);
+            p++;
+        } else {
+            while (isdigit((unsigned char) *p))
+                v = v * 10 + (*p++ - '0');
+        }
+    }
+    if (isIdentChar((unsigned char) *p))
+        asmError(as, "malformed number");
+    as->p = p;
+    return v;
+}
+
+static int32_t expr(Assembler *as, int minprec);
+
+static int32_t unary(Assembler *as) {
+    skipSpace(as);
+    char c = *as->p;
+
+    if (c == '#' || c == '+') {
+        as->p++;
+        return unary(as);
+    }
+    if (c == '-') {
+        as->p++;
+        return -unary(as);
+    }
+    if (c == '~') {
+        as->p++;
+        return ~unary(as);
+    }
+    if (c == '(') {
+        as->p++;
+        int32_t v = expr(as, 0);
+        skipSpace(as);
+        if (*as->p != ')')
+            asmError(as, "expected ')'");
+        as->p++;
+        return v;
+    }
+    if (c == '\'' && as->p[1] && as->p[2] == '\'') {
+        int32_t v = (uint8_t) as->p[1];
+        as->p += 3;
+        return v;
+    }
+    if (c == '$' && hexValue(as->p[1]) < 0) {
+        as->p++;
+        return as->insnStart;
+    }
+    if (c == '$' || isdigit((unsigned char) c))
+        return number(as);
+    if (isIdentStart((unsigned char) c)) {
+        char name[SYMBOL_MAX];
+        size_t n = 0;
+        while (isIdentChar((unsigned char) as->p[n]))
+            n++;
+        if (n >= SYMBOL_MAX)
+            asmError(as, "symbol name too long");
+        memcpy(name, as->p, n);
+        name[n] = 0;
+        as->p += n;
+
+        skipSpace(as);
+        if (*as->p == '(' && (strcasecmp(name, "HIGH") == 0 || strcasecmp(name, "LOW") == 0)) {
+            int32_t v = unary(as);
+            return toupper(name[0]) == 'H' ? (v >> 8) & 0xff : v & 0xff;
+        }
+
+        const Symbol *sym = symbolLookup(as->symbols, name);
+        if (sym)
+            return sym->value;
+        if (as->pass == 2)
+            asmError(as, "undefined symbol '%s'", name);
+        if (as->strict)
+            asmError(as, "'%s' must be defined before it is used here", name);
+        return 0;
+    }
+    asmError(as, "expected expression");
+    return 0;
+}
+
+static int binaryPrec(Assembler *as, int *len) {
+    const char *p = as->p;
+    *len = 1;
+    switch (*p) {
+        case '|': return 1;
+        case '^': return 2;
+        case '&': return 3;
+        case '<': if (p[1] == '<') { *len = 2; return 4; } return -1;
+        case '>': if (p[1] == '>') { *len = 2; return 4; } return -1;
+        case '+': case '-': return 5;
+        case '*': case '/': case '%': return 6;
+    }
+    return -1;
+}
+
+static int32_t expr(Assembler *as, int minprec) {
+    int32_t lhs = unary(as);
+    for (;;) {
+        int len, prec;
+        skipSpace(as);
+        prec = binaryPrec(as, &len);
+        if (prec < 0 || prec <= minprec)
+            return lhs;
+        char op = *as->p;
+        as->p += len;
+        int32_t rhs = expr(as, prec);
+        switch (op) {
+            case '|': lhs |= rhs; break;
+            case '^': lhs ^= rhs; break;
+            case '&': lhs &= rhs; break;
+            case '<': lhs <<= rhs; break;
+            case '>': lhs >>= rhs; break;
+            case '+': lhs += rhs; break;
+            case '-': lhs -= rhs; break;
+            case '*': lhs *= rhs; break;
+            case '/':
+            case '%':
+                if (rhs == 0) {
+                    if (as->pass == 2)
+                        asmError(as, "division by zero");
+                    lhs = 0;
+                } else {
+                    lhs = op == '/' ? lhs / rhs : lhs % rhs;
+                }
+                break;
+        }
+    }
+}
+
+static int32_t evaluate(Assembler *as, const char *text) {
+    as->p = text;
+    int32_t v = expr(as, 0);
+    skipSpace(as);
+    if (*as->p)
+        asmError(as, "unexpected '%s'", as->p);
+    return v;
+}
+
+// for operands that move the location counter: a forward reference would
+// read 0 in pass 1 and shift every label after it in pass 2
+static int32_t evaluateDefined(Assembler *as, const char *text) {
+    as->strict = 1;
+    int32_t v = evaluate(as, text);
+    as->strict = 0;
+    return v;
+}
+
+static void emitByte(Assembler *as, uint8_t value) {
+    // the native version would no longer match the code it replaces
+    int hook = hleRoutineAt(as->state, as->pc);
+    if (hook >= 0)
+        asmError(as, "$%04x is inside native routine %s", as->pc, as->state->hle->rom->hooks[hook].name);
+    if (as->pass == 2) {
+        if (as->state->hash)
+            hashWrite(as->state->hash, as->pc, memoryPeek(as->state, as->pc), value);
+        as->state->memory[as->pc] = value;
+    }
+    if (as->pc + 1 > as->end)
+        as->end = as->pc + 1;
+    as->pc++;
+}
+
+static void define(Assembler *as, const char *name, int32_t value, int label) {
+    Symbol *sym = intern(as->symbols, name);
+    if (as->pass == 1 && sym->defined)
+        asmError(as, "symbol '%s' already defined", name);
+    // code emitted in pass 2 used the pass-1 address of every label
+    if (as->pass == 2 && label && sym->value != (uint16_t) value)
+        asmError(as, "phase error: '%s' was $%04x in pass 1, $%04x in pass 2",
+                name, sym->value, (uint16_t) value);
+    sym->value = (uint16_t) value;
+    sym->defined = 1;
+    sym->label = label;
+}
+
+static char *trim(char *s) {
+    char *end;
+    while (*s == ' ' || *s == '\t')
+        s++;
+    end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        *--end = 0;
+    return s;
+}
+
+// split at top-level commas, leaving quoted strings intact
+static int splitOperands(Assembler *as, char *text, char **ops) {
+    int n = 0, depth = 0;
+    char quote = 0;
+    char *start = text;
+
+    if (*trim(text) == 0)
+        return 0;
+    for (; ; text++) {
+        char c = *text;
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+            else if (c == 0)
+                asmError(as, "unterminated string");
+            continue;
+        }
+        if (c == '"' || (c == '\'' && !(text[1] && text[2] == '\''))) {
+            quote = c;
+            continue;
+        }
+        if (c == '\'') {
+            text += 2;
+            continue;
+        }
+        if (c == '(') depth++;
+        if (c == ')') depth--;
+        if ((c == ',' && depth == 0) || c == 0) {
+            if (n == MAX_OPERANDS)
+                asmError(as, "too many operands");
+            *text = 0;
+            ops[n++] = trim(start);
+            start = text + 1;
+            if (c == 0)
+                break;
+        }
+    }
+    return n;
+}
+
+static int fixedArgs(const OpInfo *info) {
+    const char *a = info->args;
+    int n;
+    if (*a == 0)
+        return 0;
+    for (n = 1; *a; a++) {
+        if (*a == ',')
+            n++;
+    }
+    return n;
+}
+
+// operands that name registers must match the opcode table exactly
+static int argsMatch(const char *args, char **ops, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        const char *op = ops[i];
+        while (*args && *args != ',' && *op) {
+            if (toupper((unsigned char) *op) != *args)
+                return 0;
+            args++;
+            op++;
+        }
+        if (*op != 0 || (*args != ',' && *args != 0))
+            return 0;
+        if (*args == ',')
+            args++;
+    }
+    return *args == 0;
+}
+
+static int instruction(Assembler *as, const char *mnemonic, char **ops, int n) {
+    int op;
+    for (op = 0; op < 256; op++) {
+        const OpInfo *info = &opcodes8080[op];
+        if (info->mnemonic == NULL || info->mnemonic[0] != mnemonic[0] ||
+                strcmp(info->mnemonic, mnemonic) != 0)
+            continue;
+        int k = fixedArgs(info);
+        if (n != k + (info->operand != OPERAND_NONE))
+            continue;
+        if (!argsMatch(info->args, ops, k))
+            continue;
+
+        emitByte(as, (uint8_t) op);
+        if (info->operand != OPERAND_NONE) {
+            int32_t v = as->pass == 2 ? evaluate(as, ops[k]) : 0;
+            if (as->pass == 2 && info->bytes == 2 && (v < -128 || v > 255))
+                asmError(as, "value %d does not fit in a byte", v);
+            emitByte(as, v & 0xff);
+            if (info->bytes == 3)
+                emitByte(as, (v >> 8) & 0xff);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static void directive(Assembler *as, const char *name, char **ops, int n) {
+    int i;
+    if (strcmp(name, "DB") == 0) {
+        for (i = 0; i < n; i++) {
+            const char *op = ops[i];
+            if (op[0] == '"' || (op[0] == '\'' && strlen(op) != 3)) {
+                const char *s;
+                for (s = op + 1; *s && *s != op[0]; s++)
+                    emitByte(as, (uint8_t) *s);
+            } else {
+                emitByte(as, as->pass == 2 ? evaluate(as, op) & 0xff : 0);
+            }
+        }
+    } else if (strcmp(name, "DW") == 0) {
+        for (i = 0; i < n; i++) {
+            int32_t v = as->pass == 2 ? evaluate(as, ops[i]) : 0;
+            emitByte(as, v & 0xff);
+            emitByte(as, (v >> 8) & 0xff);
+        }
+    } else if (strcmp(name, "DS") == 0) {
+        if (n != 1)
+            asmError(as, "DS takes one operand");
+        int32_t size = evaluateDefined(as, ops[0]);
+        if (as->pc + size > as->end)
+            as->end = as->pc + size;
+        as->pc += (uint16_t) size;
+    } else if (strcmp(name, "ORG") == 0) {
+        if (n != 1)
+            asmError(as, "ORG takes one operand");
+        as->pc = (uint16_t) evaluateDefined(as, ops[0]);
+    } else {
+        asmError(as, "unknown instruction '%s'", name);
+    }
+}
+
+static void line(Assembler *as, char *text) {
+    char *ops[MAX_OPERANDS];
+    char label[SYMBOL_MAX] = "";
+    char mnemonic[8];
+    char *p;
+    int n;
+    size_t i;
+
+    // strip comments, minding quotes
+    char quote = 0;
+    for (p = text; *p; p++) {
+        if (quote) {
+            if (*p == quote)
+                quote = 0;
+        } else if (*p == '\'' && p[1] && p[2] == '\'') {
+            p += 2;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == ';') {
+            *p = 0;
+            break;
+        }
+    }
+    p = trim(text);
+    if (*p == 0)
+        return;
+
+    // label, either "name:" or a bare name in front of EQU
+    if (isIdentStart((unsigned char) *p)) {
+        char *q = p;
+        while (isIdentChar((unsigned char) *q))
+            q++;
+        char *r = q;
+        while (*r == ' ' || *r == '\t')
+            r++;
+        int colon = (*r == ':');
+        int equ = !colon && strncasecmp(r, "EQU", 3) == 0 && !isIdentChar((unsigned char) r[3]);
+        if (colon || equ) {
+            if ((size_t) (q - p) >= SYMBOL_MAX)
+                asmError(as, "symbol name too long");
+            memcpy(label, p, q - p);
+            label[q - p] = 0;
+            p = trim(colon ? r + 1 : r);
+        }
+    }
+
+    as->insnStart = as->pc;
+    if (*p == 0) {
+        if (label[0])
+            define(as, label, as->pc, 1);
+        return;
+    }
+
+    for (i = 0; isalpha((unsigned char) p[i]); i++) {
+        if (i + 1 >= sizeof(mnemonic))
+            asmError(as, "unknown instruction");
+        mnemonic[i] = toupper((unsigned char) p[i]);
+    }
+    mnemonic[i] = 0;
+    if (i == 0)
+        asmError(as, "expected instruction");
+    n = splitOperands(as, p + i, ops);
+
+    if (strcmp(mnemonic, "EQU") == 0) {
+        if (!label[0] || n != 1)
+            asmError(as, "EQU needs a name and one operand");
+        // forward references read as 0 in pass 1 and settle in pass 2
+        define(as, label, evaluate(as, ops[0]), 0);
+        return;
+    }
+    if (strcmp(mnemonic, "END") == 0)
+        return;
+
+    if (label[0])
+        define(as, label, as->pc, 1);
+    if (!instruction(as, mnemonic, ops, n))
+        directive(as, mnemonic, ops, n);
+}
+
+static void run(Assembler *as, const char *source, uint16_t origin) {
+    const char *s = source;
+    char buffer[ASM_LINE_MAX];
+
+    as->pc = origin;
+    as->line = 0;
+    as->end = origin;
+    while (*s) {
+        const char *eol = strchr(s, '\n');
+        size_t len = eol ? (size_t) (eol - s) : strlen(s);
+        as->line++;
+        if (len >= sizeof(buffer))
+            asmError(as, "line too long");
+        memcpy(buffer, s, len);
+        buffer[len] = 0;
+        line(as, buffer);
+        s += len + (eol != NULL);
+    }
+}
+
+int assemble(State* state, const char *source, uint16_t origin, Symbols *symbols, char *err, size_t errlen) {
+    Symbols local;
+    Assembler as;
+
+    memset(&local, 0, sizeof(local));
+    memset(&as, 0, sizeof(as));
+    as.state = state;
+    as.symbols = symbols ? symbols : &local;
+    as.err = err;
+    as.errlen = errlen;
+    symbolsClear(as.symbols);
+
+    // breakpoints in the output pick up the assembled bytes when re-armed
+    disarmBreakpoints(state);
+    if (setjmp(as.fail)) {
+        armBreakpoints(state);
+        symbolsFree(&local);
+        return -1;
+    }
+    as.pass = 1;
+    run(&as, source, origin);
+    as.pass = 2;
+    run(&as, source, origin);
+    armBreakpoints(state);
+    if (as.symbols->cap)
+        indexLabels(as.symbols);
+
+    symbolsFree(&local);
+    return as.end - origin;
+}
@@ -0,0 +1,39 @@
+#ifndef SCL_ASSEMBLER_H
+#define SCL_ASSEMBLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "8080.h"
+
+#define SYMBOL_MAX 32
+
+typedef struct Symbol {
+    char name[SYMBOL_MAX];
+    uint16_t value;
+    uint8_t defined;
+    uint8_t label;      // 1 for code/data labels, 0 for EQU constants
+} Symbol;
+
+// open-addressed by name; byAddress is rebuilt after each assemble() for
+// address -> label lookups from the debugger and profiler
+typedef struct Symbols {
+    Symbol *table;
+    int cap;
+    int count;
+    int *byAddress;
+    int labels;
+} Symbols;
+
+// assemble source into state->memory starting at origin; symbols may be
+// NULL, otherwise it is cleared and refilled, reusing its storage. Returns
+// the span from origin to the highest address reached, DS gaps included, or
+// -1 with a message in err.
+int assemble(State* state, const char *source, uint16_t origin, Symbols *symbols, char *err, size_t errlen);
+
+const Symbol *symbolLookup(const Symbols *symbols, const char *name);
+const Symbol *symbolFor(const Symbols *symbols, uint16_t addr, uint16_t *offset);
+void symbolsClear(Symbols *symbols);
+void symbolsFree(Symbols *symbols);
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080.h"
+#include "scl.h"
+
+// 8080 register numbers as used in the opcode encoding
+enum {
+    REG_B = 0,
+    REG_C,
+    REG_D,
+    REG_E,
+    REG_H,
+    REG_L,
+    REG_M,
+    REG_A,
+};
+
+#define SPILLED -1
+
+typedef struct Interval {
+    int vreg;
+    int start;
+    int end;
+} Interval;
+
+typedef struct Codegen {
+    const IrProgram *ir;
+    AsmProgram *out;
+    int *reg;           // 8080 register per vreg, or SPILLED
+    int *slot;          // spill slot per vreg
+    int spills;
+} Codegen;
+
+static int words(int bits) {
+    return (bits + 63) / 64;
+}
+
+static int uses(const IrInsn *insn, int v) {
+    if (insn->a.kind == VAL_VREG && insn->a.n == v) return 1;
+    if (insn->b.kind == VAL_VREG && insn->b.n == v) return 1;
+    return 0;
+}
+
+static int defines(const IrInsn *insn) {
+    switch (insn->op) {
+        case IR_COPY: case IR_ADD: case IR_SUB: case IR_AND: case IR_OR: case IR_XOR:
+            return insn->dst;
+    }
+    return -1;
+}
+
+// live-in sets per instruction, one bitset of ir->vregs bits each
+static uint64_t *liveness(const IrProgram *ir) {
+    int n = ir->count;
+    int w = words(ir->vregs);
+    uint64_t *in = calloc((size_t) (n + 1) * w, sizeof(uint64_t));
+    int *labelAt = malloc((ir->labels + 1) * sizeof(int));
+    int i, k, changed;
+
+    for (i = 0; i < n; i++) {
+        if (ir->code[i].op == IR_LABEL)
+            labelAt[ir->code[i].label] = i;
+    }
+
+    do {
+        changed = 0;
+        for (i = n - 1; i >= 0; i--) {
+            const IrInsn *insn = &ir->code[i];
+            uint64_t *live = &in[i * w];
+            uint64_t out[w > 0 ? w : 1];
+            memset(out, 0, sizeof(out));
+
+            if (insn->op != IR_HALT && insn->op != IR_JMP) {
+                for (k = 0; k < w; k++)
+                    out[k] |= in[(i + 1) * w + k];
+            }
+            if (insn->op == IR_JMP || insn->op == IR_BR) {
+                int t = labelAt[insn->label];
+                for (k = 0; k < w; k++)
+                    out[k] |= in[t * w + k];
+            }
+
+            int d = defines(insn);
+            if (d >= 0)
+                out[d / 64] &= ~(1ULL << (d % 64));
+            if (insn->a.kind == VAL_VREG)
+                out[insn->a.n / 64] |= 1ULL << (insn->a.n % 64);
+            if (insn->b.kind == VAL_VREG)
+                out[insn->b.n / 64] |= 1ULL << (insn->b.n % 64);
+
+            for (k = 0; k < w; k++) {
+                if (live[k] != out[k]) {
+                    live[k] = out[k];
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    free(labelAt);
+    return in;
+}
+
+static int byStart(const void *x, const void *y) {
+    const Interval *a = x, *b = y;
+    return a->start != b->start ? a->start - b->start : a->vreg - b->vreg;
+}
+
+// linear scan over the given register pool, returns the number of spills
+static int linearScan(Codegen *cg, Interval *iv, int count, const int *pool, int npool) {
+    Interval *active[8];
+    int nactive = 0;
+    int spills = 0;
+    int i, j;
+
+    for (i = 0; i < cg->ir->vregs; i++)
+        cg->reg[i] = SPILLED;
+
+    for (i = 0; i < count; i++) {
+        Interval *cur = &iv[i];
+
+        // expire intervals whose last use is at or before this start
+        for (j = 0; j < nactive; ) {
+            if (active[j]->end <= cur->start)
+                active[j] = active[--nactive];
+            else
+                j++;
+        }
+
+        if (nactive < npool) {
+            int r, used = 0;
+            for (j = 0; j < nactive; j++)
+                used |= 1 << cg->reg[active[j]->vreg];
+            for (r = 0; r < npool; r++) {
+                if (!(used & (1 << pool[r])))
+                    break;
+            }
+            cg->reg[cur->vreg] = pool[r];
+            active[nactive++] = cur;
+            continue;
+        }
+
+        // spill whichever interval lives longest
+        int victim = 0;
+        for (j = 1; j < nactive; j++) {
+            if (active[j]->end > active[victim]->end)
+                victim = j;
+        }
+        if (active[victim]->end > cur->end) {
+            cg->reg[cur->vreg] = cg->reg[active[victim]->vreg];
+            cg->reg[active[victim]->vreg] = SPILLED;
+            active[victim] = cur;
+        }
+        spills++;
+    }
+    return spills;
+}
+
+static void allocate(Codegen *cg) {
+    static const int all[] = {REG_B, REG_C, REG_D, REG_E, REG_H, REG_L};
+    static const int noHL[] = {REG_B, REG_C, REG_D, REG_E};
+    const IrProgram *ir = cg->ir;
+    int w = words(ir->vregs);
+    uint64_t *in = liveness(ir);
+    Interval *iv = malloc((ir->vregs + 1) * sizeof(Interval));
+    int count = 0;
+    int v, i;
+
+    for (v = 0; v < ir->vregs; v++) {
+        int start = -1, end = -1;
+        for (i = 0; i < ir->count; i++) {
+            const IrInsn *insn = &ir->code[i];
+            int live = (in[i * w + v / 64] >> (v % 64)) & 1;
+            if (live || defines(insn) == v || uses(insn, v)) {
+                if (start < 0)
+                    start = i;
+                end = i;
+            }
+        }
+        if (start >= 0) {
+            iv[count].vreg = v;
+            iv[count].start = start;
+            iv[count].end = end;
+            count++;
+        }
+    }
+    qsort(iv, count, sizeof(Interval), byStart);
+
+    // HL doubles as the pointer to spilled values, so only hand it out
+    // when everything fits in registers
+    if (linearScan(cg, iv, count, all, 6) > 0)
+        linearScan(cg, iv, count, noHL, 4);
+
+    cg->spills = 0;
+    for (v = 0; v < ir->vregs; v++) {
+        if (cg->reg[v] == SPILLED)
+            cg->slot[v] = cg->spills++;
+    }
+
+    free(iv);
+    free(in);
+}
+
+static uint16_t slotAddr(Codegen *cg, int v) {
+    return SCL_DATA_BASE + cg->slot[v];
+}
+
+static void emitOp(Codegen *cg, uint8_t opcode, uint16_t operand) {
+    asmEmit(cg->out, opcode, operand, -1);
+}
+
+static void loadA(Codegen *cg, IrValue v) {
+    if (v.kind == VAL_IMM)
+        emitOp(cg, 0x3e, v.n);                              // MVI A,byte
+    else if (cg->reg[v.n] == SPILLED)
+        emitOp(cg, 0x3a, slotAddr(cg, v.n));                // LDA addr
+    else
+        emitOp(cg, 0x78 | cg->reg[v.n], 0);                 // MOV A,r
+}
+
+static void storeA(Codegen *cg, int v) {
+    if (cg->reg[v] == SPILLED)
+        emitOp(cg, 0x32, slotAddr(cg, v));                  // STA addr
+    else
+        emitOp(cg, 0x47 | (cg->reg[v] << 3), 0);            // MOV r,A
+}
+
+// apply an ALU operation to A; alu is the 0..7 group index (ADD..CMP)
+static void aluA(Codegen *cg, int alu, IrValue v) {
+    if (v.kind == VAL_IMM) {
+        emitOp(cg, 0xc6 | (alu << 3), v.n);                 // ADI..CPI byte
+    } else if (cg->reg[v.n] == SPILLED) {
+        emitOp(cg, 0x21, slotAddr(cg, v.n));                // LXI H,addr
+        emitOp(cg, 0x80 | (alu << 3) | REG_M, 0);           // op M
+    } else {
+        emitOp(cg, 0x80 | (alu << 3) | cg->reg[v.n], 0);    // op r
+    }
+}
+
+static void copy(Codegen *cg, int dst, IrValue v) {
+    int d = cg->reg[dst];
+    if (d != SPILLED && v.kind == VAL_IMM) {
+        emitOp(cg, 0x06 | (d << 3), v.n);                   // MVI r,byte
+    } else if (d != SPILLED && v.kind == VAL_VREG && cg->reg[v.n] != SPILLED) {
+        if (d != cg->reg[v.n])
+            emitOp(cg, 0x40 | (d << 3) | cg->reg[v.n], 0);  // MOV r,r
+    } else {
+        loadA(cg, v);
+        storeA(cg, dst);
+    }
+}
+
+static void branch(Codegen *cg, const IrInsn *insn) {
+    static const uint8_t jcc[] = {
+        0xca,   // COND_EQ: JZ
+        0xc2,   // COND_NE: JNZ
+        0xda,   // COND_LT: JC
+        0xd2,   // COND_GE: JNC
+    };
+    loadA(cg, insn->a);
+    aluA(cg, 7, insn->b);
+    asmEmit(cg->out, jcc[insn->cond], 0, insn->label);
+}
+
+int sclCodegen(const IrProgram *ir, AsmProgram *out) {
+    static const int alu[] = {
+        [IR_ADD] = 0,
+        [IR_SUB] = 2,
+        [IR_AND] = 4,
+        [IR_XOR] = 5,
+        [IR_OR] = 6,
+    };
+    Codegen cg;
+    int i;
+
+    memset(out, 0, sizeof(*out));
+    out->labels = ir->labels;
+    cg.ir = ir;
+    cg.out = out;
+    cg.reg = malloc((ir->vregs + 1) * sizeof(int));
+    cg.slot = malloc((ir->vregs + 1) * sizeof(int));
+    allocate(&cg);
+
+    for (i = 0; i < ir->count; i++) {
+        const IrInsn *insn = &ir->code[i];
+        switch (insn->op) {
+            case IR_COPY:
+                copy(&cg, insn->dst, insn->a);
+                break;
+            case IR_ADD: case IR_SUB: case IR_AND: case IR_OR: case IR_XOR:
+                loadA(&cg, insn->a);
+                aluA(&cg, alu[insn->op], insn->b);
+                storeA(&cg, insn->dst);
+                break;
+            case IR_OUT:
+                loadA(&cg, insn->a);
+                emitOp(&cg, 0xd3, 1);                       // OUT 1
+                break;
+            case IR_LABEL:
+                asmEmit(out, ASM_LABEL, 0, insn->label);
+                break;
+            case IR_JMP:
+                asmEmit(out, 0xc3, 0, insn->label);
+                break;
+            case IR_BR:
+                branch(&cg, insn);
+                break;
+            case IR_HALT:
+                emitOp(&cg, 0x76, 0);                       // HLT
+                break;
+        }
+    }
+
+    free(cg.reg);
+    free(cg.slot);
+    return 0;
+}
+
+void asmEmit(AsmProgram *prog, uint16_t opcode, uint16_t operand, int label) {
+    if (prog->count == prog->cap) {
+        prog->cap = prog->cap ? prog->cap * 2 : 64;
+        prog->code = realloc(prog->code, prog->cap * sizeof(AsmInsn));
+    }
+    AsmInsn insn = {opcode, operand, label};
+    prog->code[prog->count++] = insn;
+}
+
+int asmEncode(const AsmProgram *prog, uint8_t *memory, uint16_t origin) {
+    uint16_t *labelAddr = calloc(prog->labels + 1, sizeof(uint16_t));
+    uint16_t pc = origin;
+    int i;
+
+    for (i = 0; i < prog->count; i++) {
+        const AsmInsn *insn = &prog->code[i];
+        if (insn->opcode == ASM_LABEL)
+            labelAddr[insn->label] = pc;
+        else
+            pc += opcodes8080[insn->opcode].bytes;
+    }
+
+    pc = origin;
+    for (i = 0; i < prog->count; i++) {
+        const AsmInsn *insn = &prog->code[i];
+        if (insn->opcode == ASM_LABEL)
+            continue;
+        uint16_t operand = insn->label >= 0 ? labelAddr[insn->label] : insn->operand;
+        int bytes = opcodes8080[insn->opcode].bytes;
+        memory[pc] = (uint8_t) insn->opcode;
+        if (bytes > 1)
+            memory[(uint16_t) (pc + 1)] = operand & 0xff;
+        if (bytes > 2)
+            memory[(uint16_t) (pc + 2)] = operand >> 8;
+        pc += bytes;
+    }
+
+    free(labelAddr);
+    return (uint16_t) (pc - origin);
+}
+
+void asmPrint(const AsmProgram *prog, FILE *f) {
+    int i;
+    for (i = 0; i < prog->count; i++) {
+        const AsmInsn *insn = &prog->code[i];
+        if (insn->opcode == ASM_LABEL) {
+            fprintf(f, "L%d:\n", insn->label);
+            continue;
+        }
+
+        const OpInfo *info = &opcodes8080[insn->opcode];
+        char operand[16] = "";
+        switch (info->operand) {
+            case OPERAND_D8: snprintf(operand, sizeof(operand), "#$%02x", insn->operand & 0xff); break;
+            case OPERAND_D16: snprintf(operand, sizeof(operand), "#$%04x", insn->operand); break;
+            case OPERAND_PORT: snprintf(operand, sizeof(operand), "$%02x", insn->operand & 0xff); break;
+            case OPERAND_ADDR:
+                if (insn->label >= 0)
+                    snprintf(operand, sizeof(operand), "L%d", insn->label);
+                else
+                    snprintf(operand, sizeof(operand), "$%04x", insn->operand);
+                break;
+        }
+        if (info->args[0] == 0 && operand[0] == 0)
+            fprintf(f, "    %s\n", info->mnemonic);
+        else
+            fprintf(f, "    %-6s %s%s%s\n", info->mnemonic, info->args,
+                    info->args[0] && operand[0] ? "," : "", operand);
+    }
+}
+
+int asmCycles(const AsmInsn *code, int count) {
+    int i, cycles = 0;
+    for (i = 0; i < count; i++) {
+        if (code[i].opcode != ASM_LABEL)
+            cycles += cycles8080[code[i].opcode];
+    }
+    return cycles;
+}
+
+void asmFree(AsmProgram *prog) {
+    free(prog->code);
+    memset(prog, 0, sizeof(*prog));
+}
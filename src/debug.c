@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+
+static Debug *debugFor(State* state) {
+    if (state->debug == NULL)
+        state->debug = calloc(1, sizeof(Debug));
+    return state->debug;
+}
+
+static void updatePages(State* state) {
+    Debug *debug = state->debug;
+    int i, page;
+
+    memset(debug->page_flags, 0, sizeof(debug->page_flags));
+    for (i = 0; i < debug->nbreakpoints; i++)
+        debug->page_flags[debug->breakpoints[i].addr >> 8] |= PAGE_BREAKPOINT;
+    for (i = 0; i < debug->nwatchpoints; i++) {
+        const Watchpoint *w = &debug->watchpoints[i];
+        for (page = w->start >> 8; page <= w->end >> 8; page++) {
+            if (w->kind & WATCH_READ)
+                debug->page_flags[page] |= PAGE_WATCH_READ;
+            if (w->kind & WATCH_WRITE)
+                debug->page_flags[page] |= PAGE_WATCH_WRITE;
+        }
+    }
+    mapPages(state);
+}
+
+static Breakpoint *findBreakpoint(const Debug *debug, uint16_t addr) {
+    int i;
+    if (debug == NULL)
+        return NULL;
+    for (i = 0; i < debug->nbreakpoints; i++) {
+        if (debug->breakpoints[i].addr == addr)
+            return (Breakpoint *) &debug->breakpoints[i];
+    }
+    return NULL;
+}
+
+const Breakpoint *breakpointAt(const State* state, uint16_t addr) {
+    return findBreakpoint(state->debug, addr);
+}
+
+int addBreakpoint(State* state, uint16_t addr) {
+    Debug *debug = debugFor(state);
+    if (findBreakpoint(debug, addr))
+        return 0;
+    if (debug->nbreakpoints == MAX_BREAKPOINTS)
+        return -1;
+
+    Breakpoint *bp = &debug->breakpoints[debug->nbreakpoints++];
+    bp->addr = addr;
+    bp->saved = state->memory[addr];
+    state->memory[addr] = TRAP_OPCODE;
+    updatePages(state);
+    return 0;
+}
+
+int removeBreakpoint(State* state, uint16_t addr) {
+    Debug *debug = state->debug;
+    Breakpoint *bp = findBreakpoint(debug, addr);
+    if (bp == NULL)
+        return -1;
+
+    state->memory[addr] = bp->saved;
+    *bp = debug->breakpoints[--debug->nbreakpoints];
+    updatePages(state);
+    return 0;
+}
+
+int addWatchpoint(State* state, uint16_t addr, uint16_t len, int kind) {
+    Debug *debug = debugFor(state);
+    if (len == 0 || debug->nwatchpoints == MAX_WATCHPOINTS)
+        return -1;
+
+    Watchpoint *w = &debug->watchpoints[debug->nwatchpoints++];
+    w->start = addr;
+    w->end = (uint16_t) (addr + len - 1) < addr ? 0xffff : addr + len - 1;
+    w->kind = kind;
+    updatePages(state);
+    return 0;
+}
+
+int removeWatchpoint(State* state, uint16_t addr, uint16_t len, int kind) {
+    Debug *debug = state->debug;
+    int i;
+    if (debug == NULL)
+        return -1;
+    for (i = 0; i < debug->nwatchpoints; i++) {
+        Watchpoint *w = &debug->watchpoints[i];
+        if (w->start == addr && w->end - w->start + 1 == len && w->kind == kind) {
+            *w = debug->watchpoints[--debug->nwatchpoints];
+            updatePages(state);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// run the instruction under a breakpoint at pc, leaving the trap in place
+int stepOverBreakpoint(State* state) {
+    Breakpoint *bp = findBreakpoint(state->debug, state->pc);
+    if (bp == NULL)
+        return Emulate8080(state);
+
+    // writes to the address during the step already landed in bp->saved
+    state->memory[bp->addr] = bp->saved;
+    int stop = Emulate8080(state);
+    state->memory[bp->addr] = TRAP_OPCODE;
+    return stop;
+}
+
+// put the original bytes back so memory can be replaced wholesale (e.g. a
+// save-state restore), then armBreakpoints re-reads them and re-patches
+void disarmBreakpoints(State* state) {
+    Debug *debug = state->debug;
+    int i;
+    for (i = 0; debug && i < debug->nbreakpoints; i++)
+        state->memory[debug->breakpoints[i].addr] = debug->breakpoints[i].saved;
+}
+
+void armBreakpoints(State* state) {
+    Debug *debug = state->debug;
+    int i;
+    for (i = 0; debug && i < debug->nbreakpoints; i++) {
+        Breakpoint *bp = &debug->breakpoints[i];
+        bp->saved = state->memory[bp->addr];
+        state->memory[bp->addr] = TRAP_OPCODE;
+    }
+}
+
+static void checkWatch(State* state, uint16_t addr, int kind) {
+    const Debug *debug = state->debug;
+    int i;
+    for (i = 0; i < debug->nwatchpoints; i++) {
+        const Watchpoint *w = &debug->watchpoints[i];
+        if ((w->kind & kind) && addr >= w->start && addr <= w->end) {
+            state->stop_reason = kind == WATCH_READ ? STOP_WATCH_READ : STOP_WATCH_WRITE;
+            state->stop_addr = addr;
+            return;
+        }
+    }
+}
+
+uint8_t debugRead(State* state, uint16_t addr) {
+    Debug *debug = state->debug;
+    uint8_t flags = debug->page_flags[addr >> 8];
+    uint8_t value = state->memory[addr];
+
+    if (flags & PAGE_BREAKPOINT) {
+        const Breakpoint *bp = findBreakpoint(debug, addr);
+        if (bp)
+            value = bp->saved;
+    }
+    if (flags & PAGE_WATCH_READ)
+        checkWatch(state, addr, WATCH_READ);
+    return value;
+}
+
+void debugWrite(State* state, uint16_t addr, uint8_t value) {
+    Debug *debug = state->debug;
+    uint8_t flags = debug->page_flags[addr >> 8];
+    Breakpoint *bp = (flags & PAGE_BREAKPOINT) ? findBreakpoint(debug, addr) : NULL;
+
+    if (bp)
+        bp->saved = value;
+    else
+        state->memory[addr] = value;
+    if (flags & PAGE_WATCH_WRITE)
+        checkWatch(state, addr, WATCH_WRITE);
+}
@@ -0,0 +1,58 @@
+#ifndef SCL_DEBUG_H
+#define SCL_DEBUG_H
+
+#include <stdint.h>
+
+#include "8080.h"
+
+#define MAX_BREAKPOINTS 64
+#define MAX_WATCHPOINTS 64
+
+// undocumented opcode patched over instructions that have a breakpoint
+#define TRAP_OPCODE 0xed
+
+enum {
+    WATCH_READ = 1,
+    WATCH_WRITE = 2,
+};
+
+// why a page is routed through the slow memory path
+enum {
+    PAGE_WATCH_READ = 0x01,
+    PAGE_WATCH_WRITE = 0x02,
+    PAGE_BREAKPOINT = 0x04,
+};
+
+typedef struct Breakpoint {
+    uint16_t addr;
+    uint8_t saved;      // original byte under the trap
+} Breakpoint;
+
+typedef struct Watchpoint {
+    uint16_t start;
+    uint16_t end;       // inclusive
+    uint8_t kind;
+} Watchpoint;
+
+struct Debug {
+    Breakpoint breakpoints[MAX_BREAKPOINTS];
+    int nbreakpoints;
+    Watchpoint watchpoints[MAX_WATCHPOINTS];
+    int nwatchpoints;
+    uint8_t page_flags[256];
+};
+
+int addBreakpoint(State* state, uint16_t addr);
+int removeBreakpoint(State* state, uint16_t addr);
+const Breakpoint *breakpointAt(const State* state, uint16_t addr);
+int addWatchpoint(State* state, uint16_t addr, uint16_t len, int kind);
+int removeWatchpoint(State* state, uint16_t addr, uint16_t len, int kind);
+int stepOverBreakpoint(State* state);
+void disarmBreakpoints(State* state);
+void armBreakpoints(State* state);
+
+// slow-path accesses for pages flagged in page_flags
+uint8_t debugRead(State* state, uint16_t addr);
+void debugWrite(State* state, uint16_t addr, uint8_t value);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash.h"
+
+static uint64_t registerHash(const State* state) {
+    uint64_t flags = state->cc.z | state->cc.s << 1 | state->cc.p << 2 |
+            state->cc.cy << 3 | state->cc.ac << 4;
+    uint64_t w1 = (uint64_t) state->a | (uint64_t) state->b << 8 | (uint64_t) state->c << 16 |
+            (uint64_t) state->d << 24 | (uint64_t) state->e << 32 | (uint64_t) state->h << 40 |
+            (uint64_t) state->l << 48 | flags << 56;
+    uint64_t w2 = (uint64_t) state->sp | (uint64_t) state->pc << 16 |
+            (uint64_t) state->int_enable << 32;
+
+    // memory terms mix inputs below 2^24; the tag bits keep both words out
+    // of that range and apart from each other, so every input is distinct
+    return hashMix(w1 | 1ULL << 62) ^ hashMix(w2 | 1ULL << 63);
+}
+
+static uint64_t pageHashFull(State* state, int page) {
+    uint64_t h = 0;
+    int i;
+    for (i = 0; i < 256; i++) {
+        uint16_t addr = (page << 8) | i;
+        h ^= hashByte(addr, memoryPeek(state, addr));
+    }
+    return h;
+}
+
+// rebuild the running hash, needed after writing state->memory directly
+void hashReset(State* state) {
+    StateHash *hash = state->hash;
+    int page;
+    hash->memory = 0;
+    for (page = 0; page < 256; page++) {
+        hash->pages[page] = pageHashFull(state, page);
+        hash->memory ^= hash->pages[page];
+    }
+}
+
+// rebuild the pages of a range that was written directly
+void hashResetRange(State* state, uint16_t addr, uint32_t len) {
+    StateHash *hash = state->hash;
+    uint32_t page;
+    for (page = addr >> 8; page <= (addr + len - 1) >> 8 && page < 256; page++) {
+        hash->memory ^= hash->pages[page];
+        hash->pages[page] = pageHashFull(state, page);
+        hash->memory ^= hash->pages[page];
+    }
+}
+
+void hashEnable(State* state, int verify) {
+    if (state->hash == NULL)
+        state->hash = calloc(1, sizeof(StateHash));
+    state->hash->verify = verify;
+    hashReset(state);
+}
+
+void hashDisable(State* state) {
+    free(state->hash);
+    state->hash = NULL;
+}
+
+uint64_t stateHashFull(State* state) {
+    uint64_t h = 0;
+    int page;
+    for (page = 0; page < 256; page++)
+        h ^= pageHashFull(state, page);
+    return h ^ registerHash(state);
+}
+
+uint64_t stateHash(State* state) {
+    uint64_t h = state->hash->memory ^ registerHash(state);
+    if (state->hash->verify) {
+        int page;
+        for (page = 0; page < 256; page++) {
+            uint64_t full = pageHashFull(state, page);
+            if (full != state->hash->pages[page]) {
+                printf("state hash mismatch in page $%02x: running %016llx, recomputed %016llx\n",
+                        page, (unsigned long long) state->hash->pages[page], (unsigned long long) full);
+                exit(1);
+            }
+        }
+    }
+    return h;
+}
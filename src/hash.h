@@ -0,0 +1,41 @@
+#ifndef SCL_HASH_H
+#define SCL_HASH_H
+
+#include <stdint.h>
+
+#include "8080.h"
+
+// XOR over every byte of memory of hashByte(addr, value), kept per page and
+// in total so a write only has to swap out one term
+struct StateHash {
+    uint64_t memory;
+    uint64_t pages[256];
+    int verify;         // recompute and compare on every stateHash()
+};
+
+// splitmix64 finalizer
+static inline uint64_t hashMix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t hashByte(uint16_t addr, uint8_t value) {
+    return hashMix(((uint64_t) addr << 8) | value);
+}
+
+static inline void hashWrite(StateHash *hash, uint16_t addr, uint8_t old, uint8_t value) {
+    uint64_t delta = hashByte(addr, old) ^ hashByte(addr, value);
+    hash->pages[addr >> 8] ^= delta;
+    hash->memory ^= delta;
+}
+
+void hashEnable(State* state, int verify);
+void hashDisable(State* state);
+void hashReset(State* state);
+void hashResetRange(State* state, uint16_t addr, uint32_t len);
+uint64_t stateHash(State* state);
+uint64_t stateHashFull(State* state);
+
+#endif
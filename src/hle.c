@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "hash.h"
+#include "hle.h"
+
+#define VERIFY_STEP_LIMIT 10000000
+#define VRAM_START 0x2400
+#define VRAM_END 0x4000
+
+// any page in the range the debugger watches or has a breakpoint in; the
+// native versions can't stop half way, so those calls are interpreted
+static int watched(const State* state, uint16_t addr, uint32_t len) {
+    uint32_t page;
+    if (state->debug == NULL || len == 0)
+        return 0;
+    for (page = addr >> 8; page <= (addr + len - 1) >> 8; page++) {
+        if (state->debug->page_flags[page & 0xff])
+            return 1;
+    }
+    return 0;
+}
+
+// pointer to the whole range if every page of it is on the fast path
+static uint8_t *direct(uint8_t **map, uint16_t addr, uint32_t len) {
+    uint32_t page;
+    if (addr + len > 0x10000)
+        return NULL;
+    for (page = addr >> 8; page <= (addr + len - 1) >> 8; page++) {
+        if (map[page] == NULL)
+            return NULL;
+    }
+    return map[addr >> 8] + (addr & 0xff);
+}
+
+static void ret(State* state) {
+    state->pc = memoryRead(state, state->sp) | memoryRead(state, state->sp + 1) << 8;
+    state->sp += 2;
+}
+
+// 1a32: LDAX D; MOV M,A; INX H; INX D; DCR B; JNZ 1a32; RET
+static int blockCopy(State* state) {
+    int n = state->b ? state->b : 256;
+    uint16_t src = (state->d << 8) | state->e;
+    uint16_t dst = (state->h << 8) | state->l;
+    int i;
+
+    if (watched(state, src, n) || watched(state, dst, n) || watched(state, state->sp, 2))
+        return -1;
+
+    // the loop copies forwards a byte at a time, which memmove matches
+    // unless the destination starts inside the source
+    const uint8_t *from = direct(state->read_map, src, n);
+    uint8_t *to = direct(state->write_map, dst, n);
+    if (from && to && (dst <= src || dst >= src + n)) {
+        memmove(to, from, n);
+        if (state->hash)
+            hashResetRange(state, dst, n);
+    } else {
+        for (i = 0; i < n; i++)
+            memoryWrite(state, dst + i, memoryRead(state, src + i));
+    }
+
+    state->a = memoryRead(state, dst + n - 1);
+    state->b = dcr(state, 1);
+    state->d = (src + n) >> 8;
+    state->e = (src + n) & 0xff;
+    state->h = (dst + n) >> 8;
+    state->l = (dst + n) & 0xff;
+    ret(state);
+    return n * (cycles8080[0x1a] + cycles8080[0x77] + cycles8080[0x23] + cycles8080[0x13] +
+            cycles8080[0x05] + cycles8080[0xc2]) + cycles8080[0xc9];
+}
+
+// 1a5c: LXI H,2400; MVI M,0; INX H; MOV A,H; CPI 40; JNZ 1a5f; RET
+static int clearScreen(State* state) {
+    int n = VRAM_END - VRAM_START;
+    int i;
+
+    if (watched(state, VRAM_START, n) || watched(state, state->sp, 2))
+        return -1;
+
+    uint8_t *to = direct(state->write_map, VRAM_START, n);
+    if (to) {
+        memset(to, 0, n);
+        if (state->hash)
+            hashResetRange(state, VRAM_START, n);
+    } else {
+        for (i = 0; i < n; i++)
+            memoryWrite(state, VRAM_START + i, 0);
+    }
+
+    state->h = VRAM_END >> 8;
+    state->l = 0;
+    state->a = state->h;
+    cmpA(state, VRAM_END >> 8);
+    ret(state);
+    return cycles8080[0x21] + n * (cycles8080[0x36] + cycles8080[0x23] + cycles8080[0x7c] +
+            cycles8080[0xfe] + cycles8080[0xc2]) + cycles8080[0xc9];
+}
+
+// 1439: PUSH B; LDAX D; MOV M,A; INX D; LXI B,0020; DAD B; POP B; DCR B;
+// JNZ 1439; RET -- one byte per row down a column of the frame buffer
+static int drawSimpleSprite(State* state) {
+    int n = state->b ? state->b : 256;
+    uint16_t de = (state->d << 8) | state->e;
+    uint16_t hl = (state->h << 8) | state->l;
+    uint16_t sp = state->sp;
+    int i, cycles = 0;
+
+    if (watched(state, sp - 2, 4) || watched(state, de, n))
+        return -1;
+    for (i = 0; i < n; i++) {
+        if (watched(state, hl + 0x20 * i, 1))
+            return -1;
+    }
+
+    // the pushed BC is read back every row, so stay byte exact in case the
+    // sprite overlaps the stack
+    do {
+        memoryWrite(state, sp - 1, state->b);
+        memoryWrite(state, sp - 2, state->c);
+        state->a = memoryRead(state, de++);
+        memoryWrite(state, hl, state->a);
+        state->cc.cy = hl + 0x20 > 0xffff;
+        hl += 0x20;
+        state->c = memoryRead(state, sp - 2);
+        state->b = dcr(state, memoryRead(state, sp - 1));
+        cycles += cycles8080[0xc5] + cycles8080[0x1a] + cycles8080[0x77] + cycles8080[0x13] +
+                cycles8080[0x01] + cycles8080[0x09] + cycles8080[0xc1] + cycles8080[0x05] +
+                cycles8080[0xc2];
+    } while (state->b != 0);
+
+    state->d = de >> 8;
+    state->e = de & 0xff;
+    state->h = hl >> 8;
+    state->l = hl & 0xff;
+    ret(state);
+    return cycles + cycles8080[0xc9];
+}
+
+static const HleHook invadersHooks[] = {
+    {0x1439, 0x1446, "DrawSimpSprite", drawSimpleSprite},
+    {0x1a32, 0x1a3a, "BlockCopy", blockCopy},
+    {0x1a5c, 0x1a68, "ClearScreen", clearScreen},
+};
+
+static const HleRom knownRoms[] = {
+    {"Space Invaders", 0x2000, 0xb64ca815, invadersHooks, sizeof(invadersHooks) / sizeof(invadersHooks[0])},
+};
+
+int hleEnable(State* state, int verify, char *err, size_t errlen) {
+    const HleRom *rom = NULL;
+    Hle *hle;
+    int i;
+
+    if (state->hle) {
+        snprintf(err, errlen, "HLE hooks already installed");
+        return -1;
+    }
+    for (i = 0; i < (int) (sizeof(knownRoms) / sizeof(knownRoms[0])); i++) {
+        if (memoryChecksum(state, 0, knownRoms[i].rom_size) == knownRoms[i].checksum) {
+            rom = &knownRoms[i];
+            break;
+        }
+    }
+    if (rom == NULL) {
+        snprintf(err, errlen, "no HLE hooks for this ROM");
+        return -1;
+    }
+
+    hle = calloc(1, sizeof(Hle));
+    hle->rom = rom;
+    hle->verify = verify;
+    if (verify)
+        hle->scratch = malloc(2 * 0x10000);
+    // traps sit underneath breakpoints: a breakpoint already on a hook
+    // keeps its TRAP_OPCODE and now saves the HLE trap instead
+    for (i = 0; i < rom->count; i++) {
+        uint16_t pc = rom->hooks[i].pc;
+        Breakpoint *bp = (Breakpoint *) breakpointAt(state, pc);
+        uint8_t *under = bp ? &bp->saved : &state->memory[pc];
+        hle->saved[i] = *under;
+        hle->pages[pc >> 8] = 1;
+        *under = HLE_OPCODE;
+    }
+    state->hle = hle;
+    mapPages(state);
+    return 0;
+}
+
+void hleDisable(State* state) {
+    Hle *hle = state->hle;
+    int i;
+    if (hle == NULL)
+        return;
+    for (i = 0; i < hle->rom->count; i++) {
+        uint16_t pc = hle->rom->hooks[i].pc;
+        Breakpoint *bp = (Breakpoint *) breakpointAt(state, pc);
+        *(bp ? &bp->saved : &state->memory[pc]) = hle->saved[i];
+    }
+    free(hle->scratch);
+    free(hle);
+    state->hle = NULL;
+    mapPages(state);
+}
+
+int hleIndex(const State* state, uint16_t addr) {
+    const Hle *hle = state->hle;
+    int i;
+    if (hle == NULL || !hle->pages[addr >> 8])
+        return -1;
+    for (i = 0; i < hle->rom->count; i++) {
+        if (hle->rom->hooks[i].pc == addr)
+            return i;
+    }
+    return -1;
+}
+
+int hleRoutineAt(const State* state, uint16_t addr) {
+    const Hle *hle = state->hle;
+    int i;
+    for (i = 0; hle && i < hle->rom->count; i++) {
+        if (addr >= hle->rom->hooks[i].pc && addr <= hle->rom->hooks[i].end)
+            return i;
+    }
+    return -1;
+}
+
+static uint8_t packFlags(const State* state) {
+    return state->cc.z | state->cc.s << 1 | state->cc.p << 2 | state->cc.cy << 3 | state->cc.ac << 4;
+}
+
+static void printRegisters(const char *label, const State* state, uint64_t cycles) {
+    printf("  %-11s A $%02x B $%02x C $%02x D $%02x E $%02x H $%02x L $%02x F $%02x SP %04x PC %04x cycles %llu\n",
+            label, state->a, state->b, state->c, state->d, state->e, state->h, state->l,
+            packFlags(state), state->sp, state->pc, (unsigned long long) cycles);
+}
+
+// run the native version, then rewind and interpret the routine with the
+// trap lifted, and exit if the two disagree on anything
+static int verifyRun(State* state, int index) {
+    Hle *hle = state->hle;
+    const HleHook *hook = &hle->rom->hooks[index];
+    uint8_t *before = hle->scratch;
+    uint8_t *native = hle->scratch + 0x10000;
+    StateHash *hash = state->hash;
+    Metrics *metrics = state->metrics;
+    State start, end;
+    int cycles, steps;
+
+    // both runs write memory, keep them out of the hash and counters
+    state->hash = NULL;
+    state->metrics = NULL;
+    state->pc = hook->pc;
+    start = *state;
+    memcpy(before, state->memory, 0x10000);
+
+    cycles = hook->fn(state);
+    if (cycles < 0) {
+        state->hash = hash;
+        state->metrics = metrics;
+        return -1;
+    }
+    end = *state;
+    memcpy(native, state->memory, 0x10000);
+
+    *state = start;
+    memcpy(state->memory, before, 0x10000);
+    uint16_t ret_pc = memoryPeek(state, state->sp) | memoryPeek(state, state->sp + 1) << 8;
+    uint16_t ret_sp = state->sp + 2;
+    state->memory[hook->pc] = hle->saved[index];
+    for (steps = 0; steps < VERIFY_STEP_LIMIT; steps++) {
+        if (state->pc == ret_pc && state->sp == ret_sp)
+            break;
+        Emulate8080(state);
+    }
+    state->memory[hook->pc] = HLE_OPCODE;
+
+    uint64_t interpreted = state->cycles - start.cycles;
+    if (end.a != state->a || end.b != state->b || end.c != state->c || end.d != state->d ||
+            end.e != state->e || end.h != state->h || end.l != state->l || end.sp != state->sp ||
+            end.pc != state->pc || packFlags(&end) != packFlags(state) ||
+            (uint64_t) cycles != interpreted || memcmp(native, state->memory, 0x10000) != 0) {
+        int i;
+        printf("hle %s: native and interpreted results differ\n", hook->name);
+        printRegisters("start", &start, 0);
+        printRegisters("native", &end, cycles);
+        printRegisters("interpreted", state, interpreted);
+        for (i = 0; i < 0x10000; i++) {
+            if (native[i] != state->memory[i])
+                printf("  $%04x native $%02x interpreted $%02x\n", i, native[i], state->memory[i]);
+        }
+        exit(1);
+    }
+
+    state->cycles = start.cycles;
+    state->hash = hash;
+    state->metrics = metrics;
+    if (hash)
+        hashReset(state);
+    return cycles;
+}
+
+int hleRun(State* state, int index) {
+    Hle *hle = state->hle;
+    const HleHook *hook = &hle->rom->hooks[index];
+    int cycles;
+
+    if (watched(state, hook->pc, hook->end - hook->pc + 1))
+        cycles = -1;
+    else if (hle->verify)
+        cycles = verifyRun(state, index);
+    else
+        cycles = hook->fn(state);
+
+    if (cycles < 0)
+        hle->fallbacks++;
+    else
+        hle->calls[index]++;
+    return cycles;
+}
+
+// interpret the original first instruction of a hooked routine
+int hleStep(State* state, int index) {
+    Hle *hle = state->hle;
+    uint16_t pc = hle->rom->hooks[index].pc;
+
+    // writes to pc during the step land in hle->saved via the slow path
+    state->pc = pc;
+    state->memory[pc] = hle->saved[index];
+    int stop = Emulate8080(state);
+    state->memory[pc] = HLE_OPCODE;
+    return stop;
+}
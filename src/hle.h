@@ -0,0 +1,58 @@
+#ifndef SCL_HLE_H
+#define SCL_HLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "8080.h"
+
+#define MAX_HLE_HOOKS 16
+
+// undocumented opcode patched over the entry of a routine with a native version
+#define HLE_OPCODE 0xfd
+
+// Native version of a ROM routine, entered at pc with the return address on
+// the stack. It must leave registers, flags, memory and sp/pc exactly as the
+// interpreted code would and return the cycles that took, or -1 to have
+// the routine interpreted instead (e.g. when a watched page is touched).
+typedef int (*HleFn)(State* state);
+
+typedef struct HleHook {
+    uint16_t pc;
+    uint16_t end;           // last byte of the routine, for breakpoint checks
+    const char *name;
+    HleFn fn;
+} HleHook;
+
+// hooks for one ROM image, only installed when its checksum matches
+typedef struct HleRom {
+    const char *name;
+    uint32_t rom_size;
+    uint32_t checksum;
+    const HleHook *hooks;
+    int count;
+} HleRom;
+
+struct Hle {
+    const HleRom *rom;
+    uint8_t saved[MAX_HLE_HOOKS];   // original bytes under the traps
+    uint8_t pages[256];             // page holds a trap
+    uint64_t calls[MAX_HLE_HOOKS];
+    uint64_t fallbacks;
+    int verify;                     // run both paths and compare
+    uint8_t *scratch;               // 2 x 64k for verify
+};
+
+// install the hooks of the first known ROM matching the loaded image
+int hleEnable(State* state, int verify, char *err, size_t errlen);
+void hleDisable(State* state);
+int hleIndex(const State* state, uint16_t addr);
+// hook whose routine includes addr, or -1
+int hleRoutineAt(const State* state, uint16_t addr);
+
+// called for HLE_OPCODE: runs the routine and returns its cycles, or -1 if
+// it has to be interpreted, in which case hleStep runs the original opcode
+int hleRun(State* state, int index);
+int hleStep(State* state, int index);
+
+#endif
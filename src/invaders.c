@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "invaders.h"
+#include "pacer.h"
+#include "scheduler.h"
+
+// the board resets the CPU if port 6 isn't written for 255 vblanks
+#define WATCHDOG_CYCLES (255 * CYCLES_PER_FRAME)
+
+static uint8_t invadersIn(State* state, uint8_t port) {
+    Invaders *board = state->io;
+    if (port == 3)
+        return (board->shift >> (8 - board->shift_offset)) & 0xff;
+    return port < 3 ? board->inputs[port] : 0;
+}
+
+static void invadersOut(State* state, uint8_t port, uint8_t value) {
+    Invaders *board = state->io;
+    switch (port) {
+        case 2:
+            board->shift_offset = value & 7;
+            break;
+        case 3:
+            board->sound[0] = value;
+            break;
+        case 4:
+            board->shift = (value << 8) | (board->shift >> 8);
+            break;
+        case 5:
+            board->sound[1] = value;
+            break;
+        case 6:
+            board->watchdog = 1;
+            break;
+    }
+}
+
+static void watchdogEvent(State* state, void *ctx) {
+    Invaders *board = ctx;
+    if (!board->watchdog) {
+        board->resets++;
+        state->pc = 0;
+        state->int_enable = 0;
+    }
+    board->watchdog = 0;
+}
+
+void invadersInit(Invaders *board) {
+    memset(board, 0, sizeof(*board));
+    board->inputs[0] = 0x0e;
+    board->inputs[1] = 0x08;
+}
+
+int invadersAttach(State* state, Invaders *board) {
+    uint64_t frame = state->cycles / CYCLES_PER_FRAME * CYCLES_PER_FRAME;
+    uint64_t mid = frame + CYCLES_PER_FRAME / 2;
+
+    // events are phased on absolute cycles so a restored save state keeps
+    // its place in the frame
+
+    state->in = invadersIn;
+    state->out = invadersOut;
+    state->io = board;
+    if (mid <= state->cycles)
+        mid += CYCLES_PER_FRAME;
+    if (scheduleEvent(state, mid, CYCLES_PER_FRAME, interruptEvent, (void *) 1) < 0 ||
+            scheduleEvent(state, frame + CYCLES_PER_FRAME, CYCLES_PER_FRAME, interruptEvent, (void *) 2) < 0 ||
+            scheduleEvent(state, (state->cycles / WATCHDOG_CYCLES + 1) * WATCHDOG_CYCLES, WATCHDOG_CYCLES,
+                    watchdogEvent, board) < 0)
+        return -1;
+    return 0;
+}
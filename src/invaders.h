@@ -0,0 +1,25 @@
+#ifndef SCL_INVADERS_H
+#define SCL_INVADERS_H
+
+#include <stdint.h>
+
+#include "8080.h"
+
+// Space Invaders I/O board. Plain fixed-width fields so it can be stored as
+// the device block of a save state.
+typedef struct Invaders {
+    uint16_t shift;         // last two bytes written to port 4
+    uint8_t shift_offset;   // port 2
+    uint8_t inputs[3];      // ports 0-2
+    uint8_t sound[2];       // port 3 and 5 latches
+    uint8_t watchdog;       // port 6 written since the last check
+    uint8_t pad;
+    uint32_t resets;        // watchdog timeouts
+} Invaders;
+
+// reset the board and connect it: ports, the mid-screen (RST 1) and vblank
+// (RST 2) interrupts and the watchdog, all as scheduler events
+void invadersInit(Invaders *board);
+int invadersAttach(State* state, Invaders *board);
+
+#endif
@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+// the list is only touched on attach/detach and snapshot, never per instruction
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static Metrics *registry;
+static MetricsSnapshot retired;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    int stop;
+    int fd;                 // listening socket, -1 for a file target
+    unsigned interval_ms;
+    char path[108];         // sizeof(sockaddr_un.sun_path)
+} exporter = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .fd = -1 };
+
+static uint64_t load(_Atomic uint64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void accumulate(MetricsSnapshot *s, Metrics *m) {
+    int i;
+    s->instructions += load(&m->instructions);
+    s->cycles += load(&m->cycles);
+    s->frames += load(&m->frames);
+    s->interrupts += load(&m->interrupts);
+    s->interrupts_masked += load(&m->interrupts_masked);
+    s->port_reads += load(&m->port_reads);
+    s->port_writes += load(&m->port_writes);
+    for (i = 0; i < 256; i++)
+        s->unimplemented[i] += load(&m->unimplemented[i]);
+}
+
+void metricsAttach(State* state) {
+    Metrics *m;
+    if (state->metrics)
+        return;
+    m = calloc(1, sizeof(Metrics));
+    pthread_mutex_lock(&registry_lock);
+    m->next = registry;
+    if (registry)
+        registry->prev = m;
+    registry = m;
+    pthread_mutex_unlock(&registry_lock);
+    state->metrics = m;
+}
+
+void metricsDetach(State* state) {
+    Metrics *m = state->metrics;
+    if (m == NULL)
+        return;
+    pthread_mutex_lock(&registry_lock);
+    accumulate(&retired, m);
+    if (m->prev)
+        m->prev->next = m->next;
+    else
+        registry = m->next;
+    if (m->next)
+        m->next->prev = m->prev;
+    pthread_mutex_unlock(&registry_lock);
+    state->metrics = NULL;
+    free(m);
+}
+
+void metricsSnapshot(MetricsSnapshot *snapshot) {
+    Metrics *m;
+    pthread_mutex_lock(&registry_lock);
+    *snapshot = retired;
+    snapshot->machines = 0;
+    for (m = registry; m; m = m->next) {
+        accumulate(snapshot, m);
+        snapshot->machines++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+// one "name value" line per counter, labelled per opcode for unimplemented hits
+void metricsWrite(const MetricsSnapshot *s, FILE *f) {
+    int i;
+    fprintf(f, "scl_machines %llu\n", (unsigned long long) s->machines);
+    fprintf(f, "scl_instructions_total %llu\n", (unsigned long long) s->instructions);
+    fprintf(f, "scl_cycles_total %llu\n", (unsigned long long) s->cycles);
+    fprintf(f, "scl_frames_total %llu\n", (unsigned long long) s->frames);
+    fprintf(f, "scl_interrupts_total %llu\n", (unsigned long long) s->interrupts);
+    fprintf(f, "scl_interrupts_masked_total %llu\n", (unsigned long long) s->interrupts_masked);
+    fprintf(f, "scl_port_reads_total %llu\n", (unsigned long long) s->port_reads);
+    fprintf(f, "scl_port_writes_total %llu\n", (unsigned long long) s->port_writes);
+    for (i = 0; i < 256; i++) {
+        if (s->unimplemented[i])
+            fprintf(f, "scl_unimplemented_total{opcode=\"0x%02x\"} %llu\n", i,
+                    (unsigned long long) s->unimplemented[i]);
+    }
+}
+
+static void dumpFile(const char *path) {
+    char tmp[sizeof(exporter.path) + 4];
+    MetricsSnapshot snapshot;
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL)
+        return;
+    metricsSnapshot(&snapshot);
+    metricsWrite(&snapshot, f);
+    if (fclose(f) == 0)
+        rename(tmp, path);
+}
+
+static void serveClient(int fd) {
+    MetricsSnapshot snapshot;
+    FILE *f = fdopen(fd, "w");
+    if (f == NULL) {
+        close(fd);
+        return;
+    }
+    metricsSnapshot(&snapshot);
+    metricsWrite(&snapshot, f);
+    fclose(f);
+}
+
+static void *exportLoop(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&exporter.lock);
+    while (!exporter.stop) {
+        if (exporter.fd >= 0) {
+            struct pollfd p = { .fd = exporter.fd, .events = POLLIN };
+            pthread_mutex_unlock(&exporter.lock);
+            if (poll(&p, 1, 100) > 0) {
+                int client = accept(exporter.fd, NULL, NULL);
+                if (client >= 0)
+                    serveClient(client);
+            }
+            pthread_mutex_lock(&exporter.lock);
+        } else {
+            struct timespec until;
+            pthread_mutex_unlock(&exporter.lock);
+            dumpFile(exporter.path);
+            pthread_mutex_lock(&exporter.lock);
+
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += exporter.interval_ms / 1000;
+            until.tv_nsec += (exporter.interval_ms % 1000) * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            while (!exporter.stop &&
+                    pthread_cond_timedwait(&exporter.wake, &exporter.lock, &until) != ETIMEDOUT)
+                ;
+        }
+    }
+    pthread_mutex_unlock(&exporter.lock);
+    return NULL;
+}
+
+int metricsExport(const char *target, unsigned interval_ms, char *err, size_t errlen) {
+    const char *path = strncmp(target, "unix:", 5) == 0 ? target + 5 : target;
+
+    if (exporter.running) {
+        snprintf(err, errlen, "metrics export already running");
+        return -1;
+    }
+    if (strlen(path) >= sizeof(exporter.path)) {
+        snprintf(err, errlen, "metrics path too long: %s", path);
+        return -1;
+    }
+    strcpy(exporter.path, path);
+    exporter.interval_ms = interval_ms;
+    exporter.stop = 0;
+    exporter.fd = -1;
+
+    if (path != target) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        unlink(path);
+        exporter.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (exporter.fd < 0 || bind(exporter.fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+                listen(exporter.fd, 8) != 0) {
+            snprintf(err, errlen, "error listening on %s: %s", path, strerror(errno));
+            if (exporter.fd >= 0)
+                close(exporter.fd);
+            exporter.fd = -1;
+            return -1;
+        }
+    }
+
+    if (pthread_create(&exporter.thread, NULL, exportLoop, NULL) != 0) {
+        snprintf(err, errlen, "error starting metrics thread");
+        if (exporter.fd >= 0)
+            close(exporter.fd);
+        exporter.fd = -1;
+        return -1;
+    }
+    exporter.running = 1;
+    return 0;
+}
+
+// stop the exporter; a file target gets one last snapshot
+void metricsExportStop(void) {
+    if (!exporter.running)
+        return;
+    pthread_mutex_lock(&exporter.lock);
+    exporter.stop = 1;
+    pthread_cond_signal(&exporter.wake);
+    pthread_mutex_unlock(&exporter.lock);
+    pthread_join(exporter.thread, NULL);
+    exporter.running = 0;
+
+    if (exporter.fd >= 0) {
+        close(exporter.fd);
+        unlink(exporter.path);
+        exporter.fd = -1;
+    } else {
+        dumpFile(exporter.path);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef SCL_METRICS_H
+#define SCL_METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "8080.h"
+
+// Counters for one machine. Only the thread running the machine writes them,
+// so an increment is a relaxed load and store (no locked instruction) and
+// snapshots from other threads read them with relaxed loads.
+struct Metrics {
+    _Atomic uint64_t instructions;
+    _Atomic uint64_t cycles;
+    _Atomic uint64_t frames;
+    _Atomic uint64_t interrupts;
+    _Atomic uint64_t interrupts_masked;
+    _Atomic uint64_t port_reads;
+    _Atomic uint64_t port_writes;
+    _Atomic uint64_t unimplemented[256];
+    Metrics *next;
+    Metrics *prev;
+};
+
+// plain copy of the counters summed over every machine
+typedef struct MetricsSnapshot {
+    uint64_t machines;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t frames;
+    uint64_t interrupts;
+    uint64_t interrupts_masked;
+    uint64_t port_reads;
+    uint64_t port_writes;
+    uint64_t unimplemented[256];
+} MetricsSnapshot;
+
+static inline void counterAdd(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+            memory_order_relaxed);
+}
+
+// attach counters to a machine and register them for snapshots; detaching
+// folds them into a retired total so aggregates never go backwards
+void metricsAttach(State* state);
+void metricsDetach(State* state);
+void metricsSnapshot(MetricsSnapshot *snapshot);
+void metricsWrite(const MetricsSnapshot *snapshot, FILE *f);
+
+// write a snapshot every interval_ms to a file (replaced atomically), or
+// answer each connection on "unix:/path" with a fresh one
+int metricsExport(const char *target, unsigned interval_ms, char *err, size_t errlen);
+void metricsExportStop(void);
+
+#endif
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "pacer.h"
+#include "scheduler.h"
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleepUntil(uint64_t deadline) {
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void pacerFrame(State* state, void *ctx);
+
+int pacerInit(Pacer *pacer, State* state, double speed, FrameFn frame, void *ctx) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->mode = speed <= 0 ? PACE_UNTHROTTLED : speed == 1 ? PACE_REALTIME : PACE_MULTIPLIER;
+    pacer->speed = speed;
+    pacer->period_ns = speed > 0 ? (uint64_t) (FRAME_NS / speed) : 0;
+    pacer->frame = frame;
+    pacer->ctx = ctx;
+    pacer->start_ns = nowNs();
+    pacer->start_cycles = state->cycles;
+    pacer->deadline = pacer->start_ns + pacer->period_ns;
+    pacer->event = scheduleEvent(state, (state->cycles / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME,
+            CYCLES_PER_FRAME, pacerFrame, pacer);
+    return pacer->event < 0 ? -1 : 0;
+}
+
+static void pacerFrame(State* state, void *ctx) {
+    Pacer *pacer = ctx;
+    int paced = pacer->mode != PACE_UNTHROTTLED;
+    uint64_t now = nowNs();
+
+    pacer->frames++;
+    if (state->metrics)
+        counterAdd(&state->metrics->frames, 1);
+
+    // video is converted at most 60 times per second of wall-clock time, using
+    // the frame's deadline when paced; a late frame is skipped unless too many
+    // already were
+    if (pacer->frame) {
+        uint64_t t = paced ? pacer->deadline : now;
+        int late = paced && now > pacer->deadline;
+        if (t >= pacer->next_draw && (!late || pacer->skip_run >= MAX_FRAME_SKIP)) {
+            pacer->frame(state, pacer->ctx);
+            // half a period of slack so rounding in period_ns can't skip one
+            pacer->next_draw = t + FRAME_NS - pacer->period_ns / 2;
+            pacer->skip_run = 0;
+            pacer->drawn++;
+            now = nowNs();
+        } else {
+            pacer->skip_run++;
+            pacer->skipped++;
+        }
+    }
+    if (!paced)
+        return;
+
+    if (now > pacer->deadline) {
+        pacer->overruns++;
+        // don't try to catch up on a long stall, just start pacing again
+        if (now - pacer->deadline > MAX_FRAME_SKIP * pacer->period_ns) {
+            pacer->deadline = now;
+            pacer->resyncs++;
+        }
+    } else {
+        sleepUntil(pacer->deadline);
+        uint64_t jitter = nowNs() - pacer->deadline;
+        pacer->sleeps++;
+        pacer->jitter_sum_ns += jitter;
+        if (jitter > pacer->jitter_max_ns)
+            pacer->jitter_max_ns = jitter;
+    }
+    pacer->deadline += pacer->period_ns;
+}
+
+void pacerReport(const Pacer *pacer, State* state, FILE *f) {
+    double elapsed = (nowNs() - pacer->start_ns) / 1e9;
+    double emulated = (double) (state->cycles - pacer->start_cycles) / CPU_HZ;
+
+    fprintf(f, "%llu frames in %.2fs (%.2fx real time), %llu drawn, %llu skipped\n",
+            (unsigned long long) pacer->frames, elapsed, elapsed > 0 ? emulated / elapsed : 0,
+            (unsigned long long) pacer->drawn, (unsigned long long) pacer->skipped);
+    if (pacer->mode != PACE_UNTHROTTLED) {
+        fprintf(f, "%llu overruns, %llu resyncs, jitter avg %.1fus max %.1fus\n",
+                (unsigned long long) pacer->overruns, (unsigned long long) pacer->resyncs,
+                pacer->sleeps ? pacer->jitter_sum_ns / 1e3 / pacer->sleeps : 0,
+                pacer->jitter_max_ns / 1e3);
+    }
+}
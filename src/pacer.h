@@ -0,0 +1,53 @@
+#ifndef SCL_PACER_H
+#define SCL_PACER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "8080.h"
+
+#define CPU_HZ 2000000
+#define FRAME_HZ 60
+#define CYCLES_PER_FRAME (CPU_HZ / FRAME_HZ)
+#define FRAME_NS (1000000000ULL / FRAME_HZ)
+#define MAX_FRAME_SKIP 4
+
+enum {
+    PACE_UNTHROTTLED,       // as fast as possible
+    PACE_REALTIME,          // 2 MHz / 60 Hz
+    PACE_MULTIPLIER,        // N times real time
+};
+
+// called at the end of an emulated frame to convert video memory; skipped
+// when running behind or faster than the display can show
+typedef void (*FrameFn)(State* state, void *ctx);
+
+typedef struct Pacer {
+    int mode;
+    double speed;
+    uint64_t period_ns;     // wall time per emulated frame, 0 when unthrottled
+    int event;              // scheduler id of the frame tick
+    uint64_t deadline;      // absolute CLOCK_MONOTONIC ns for the frame end
+    uint64_t next_draw;
+    int skip_run;
+    FrameFn frame;
+    void *ctx;
+
+    uint64_t start_ns;
+    uint64_t start_cycles;
+    uint64_t frames;
+    uint64_t drawn;
+    uint64_t skipped;
+    uint64_t overruns;      // frame finished after its deadline
+    uint64_t resyncs;       // fell so far behind the deadline was reset
+    uint64_t sleeps;
+    uint64_t jitter_sum_ns; // wake-up lateness after clock_nanosleep
+    uint64_t jitter_max_ns;
+} Pacer;
+
+// speed 0 runs unthrottled, 1 real time, anything else as a multiplier.
+// Registers a frame tick with the machine's scheduler on frame boundaries.
+int pacerInit(Pacer *pacer, State* state, double speed, FrameFn frame, void *ctx);
+void pacerReport(const Pacer *pacer, State* state, FILE *f);
+
+#endif
@@ -0,0 +1,498 @@
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scl.h"
+
+enum {
+    TOK_EOF = 0,
+    TOK_NUM,
+    TOK_IDENT,
+    TOK_VAR,
+    TOK_IF,
+    TOK_ELSE,
+    TOK_WHILE,
+    TOK_OUT,
+    TOK_HALT,
+    TOK_EQ,     // ==
+    TOK_NE,     // !=
+    TOK_LE,     // <=
+    TOK_GE,     // >=
+    TOK_CHAR,   // any single character token
+};
+
+typedef struct Parser {
+    const char *src;
+    const char *p;
+    int line;
+    int tok;
+    int ch;
+    int num;
+    char ident[64];
+    IrProgram *ir;
+    char *err;
+    size_t errlen;
+    jmp_buf fail;
+} Parser;
+
+// condition as parsed, before it is turned into a branch
+typedef struct Cond {
+    uint8_t cond;
+    IrValue a;
+    IrValue b;
+} Cond;
+
+static void parseError(Parser *ps, const char *fmt, ...) {
+    va_list ap;
+    int n = snprintf(ps->err, ps->errlen, "line %d: ", ps->line);
+    va_start(ap, fmt);
+    if (n >= 0 && (size_t) n < ps->errlen)
+        vsnprintf(ps->err + n, ps->errlen - n, fmt, ap);
+    va_end(ap);
+    longjmp(ps->fail, 1);
+}
+
+static void next(Parser *ps) {
+    for (;;) {
+        while (isspace((unsigned char) *ps->p)) {
+            if (*ps->p == '\n')
+                ps->line++;
+            ps->p++;
+        }
+        if (ps->p[0] == '/' && ps->p[1] == '/') {
+            while (*ps->p && *ps->p != '\n')
+                ps->p++;
+            continue;
+        }
+        break;
+    }
+
+    const char *p = ps->p;
+    if (*p == 0) {
+        ps->tok = TOK_EOF;
+        return;
+    }
+    if (isdigit((unsigned char) *p)) {
+        char *end;
+        long v = strtol(p, &end, 0);
+        if (v > 0xff)
+            parseError(ps, "constant %ld does not fit in a byte", v);
+        ps->num = (int) v;
+        ps->tok = TOK_NUM;
+        ps->p = end;
+        return;
+    }
+    if (*p == '\'' && p[1] && p[2] == '\'') {
+        ps->num = (uint8_t) p[1];
+        ps->tok = TOK_NUM;
+        ps->p = p + 3;
+        return;
+    }
+    if (isalpha((unsigned char) *p) || *p == '_') {
+        size_t n = 0;
+        while (isalnum((unsigned char) p[n]) || p[n] == '_')
+            n++;
+        if (n >= sizeof(ps->ident))
+            parseError(ps, "identifier too long");
+        memcpy(ps->ident, p, n);
+        ps->ident[n] = 0;
+        ps->p = p + n;
+        if (strcmp(ps->ident, "var") == 0) ps->tok = TOK_VAR;
+        else if (strcmp(ps->ident, "if") == 0) ps->tok = TOK_IF;
+        else if (strcmp(ps->ident, "else") == 0) ps->tok = TOK_ELSE;
+        else if (strcmp(ps->ident, "while") == 0) ps->tok = TOK_WHILE;
+        else if (strcmp(ps->ident, "out") == 0) ps->tok = TOK_OUT;
+        else if (strcmp(ps->ident, "halt") == 0) ps->tok = TOK_HALT;
+        else ps->tok = TOK_IDENT;
+        return;
+    }
+    if (p[1] == '=') {
+        switch (*p) {
+            case '=': ps->tok = TOK_EQ; ps->p += 2; return;
+            case '!': ps->tok = TOK_NE; ps->p += 2; return;
+            case '<': ps->tok = TOK_LE; ps->p += 2; return;
+            case '>': ps->tok = TOK_GE; ps->p += 2; return;
+        }
+    }
+    ps->tok = TOK_CHAR;
+    ps->ch = *p;
+    ps->p++;
+}
+
+static int isChar(Parser *ps, int c) {
+    return ps->tok == TOK_CHAR && ps->ch == c;
+}
+
+static void expectChar(Parser *ps, int c) {
+    if (!isChar(ps, c))
+        parseError(ps, "expected '%c'", c);
+    next(ps);
+}
+
+static void emit(Parser *ps, IrInsn insn) {
+    IrProgram *ir = ps->ir;
+    if (ir->count == ir->cap) {
+        ir->cap = ir->cap ? ir->cap * 2 : 64;
+        ir->code = realloc(ir->code, ir->cap * sizeof(IrInsn));
+    }
+    ir->code[ir->count++] = insn;
+}
+
+static int newVreg(Parser *ps, const char *name) {
+    IrProgram *ir = ps->ir;
+    if ((ir->vregs & 63) == 0)
+        ir->names = realloc(ir->names, (ir->vregs + 64) * sizeof(char *));
+    ir->names[ir->vregs] = name ? strdup(name) : NULL;
+    return ir->vregs++;
+}
+
+static int newLabel(Parser *ps) {
+    return ps->ir->labels++;
+}
+
+static int lookupVar(Parser *ps, const char *name) {
+    int i;
+    for (i = 0; i < ps->ir->vregs; i++) {
+        if (ps->ir->names[i] && strcmp(ps->ir->names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static IrValue imm(int n) {
+    IrValue v = {VAL_IMM, (uint16_t) (n & 0xff)};
+    return v;
+}
+
+static IrValue vreg(int n) {
+    IrValue v = {VAL_VREG, (uint16_t) n};
+    return v;
+}
+
+static void emitLabel(Parser *ps, int label) {
+    IrInsn insn = {IR_LABEL, 0, -1, {0}, {0}, label};
+    emit(ps, insn);
+}
+
+static void emitJump(Parser *ps, int label) {
+    IrInsn insn = {IR_JMP, 0, -1, {0}, {0}, label};
+    emit(ps, insn);
+}
+
+static IrValue binary(Parser *ps, int op, IrValue a, IrValue b) {
+    if (a.kind == VAL_IMM && b.kind == VAL_IMM) {
+        switch (op) {
+            case IR_ADD: return imm(a.n + b.n);
+            case IR_SUB: return imm(a.n - b.n);
+            case IR_AND: return imm(a.n & b.n);
+            case IR_OR: return imm(a.n | b.n);
+            case IR_XOR: return imm(a.n ^ b.n);
+        }
+    }
+    if (b.kind == VAL_IMM && b.n == 0 && op != IR_AND)
+        return a;
+    if (a.kind == VAL_IMM && a.n == 0 && op != IR_AND && op != IR_SUB)
+        return b;
+
+    IrInsn insn = {(uint8_t) op, 0, newVreg(ps, NULL), a, b, -1};
+    emit(ps, insn);
+    return vreg(insn.dst);
+}
+
+static IrValue expr(Parser *ps, int minprec);
+
+static IrValue primary(Parser *ps) {
+    if (ps->tok == TOK_NUM) {
+        IrValue v = imm(ps->num);
+        next(ps);
+        return v;
+    }
+    if (ps->tok == TOK_IDENT) {
+        int v = lookupVar(ps, ps->ident);
+        if (v < 0)
+            parseError(ps, "undeclared variable '%s'", ps->ident);
+        next(ps);
+        return vreg(v);
+    }
+    if (isChar(ps, '(')) {
+        next(ps);
+        IrValue v = expr(ps, 0);
+        expectChar(ps, ')');
+        return v;
+    }
+    if (isChar(ps, '-')) {
+        next(ps);
+        return binary(ps, IR_SUB, imm(0), primary(ps));
+    }
+    if (isChar(ps, '~')) {
+        next(ps);
+        return binary(ps, IR_XOR, primary(ps), imm(0xff));
+    }
+    parseError(ps, "expected expression");
+    return imm(0);
+}
+
+static int binaryOp(Parser *ps, int *prec) {
+    if (ps->tok != TOK_CHAR)
+        return -1;
+    switch (ps->ch) {
+        case '|': *prec = 1; return IR_OR;
+        case '^': *prec = 2; return IR_XOR;
+        case '&': *prec = 3; return IR_AND;
+        case '+': *prec = 4; return IR_ADD;
+        case '-': *prec = 4; return IR_SUB;
+    }
+    return -1;
+}
+
+static IrValue expr(Parser *ps, int minprec) {
+    IrValue lhs = primary(ps);
+    int prec;
+    int op;
+    while ((op = binaryOp(ps, &prec)) >= 0 && prec > minprec) {
+        next(ps);
+        IrValue rhs = expr(ps, prec);
+        lhs = binary(ps, op, lhs, rhs);
+    }
+    return lhs;
+}
+
+static Cond condition(Parser *ps) {
+    Cond c;
+    IrValue lhs = expr(ps, 0);
+    IrValue rhs;
+    int op = ps->tok == TOK_CHAR ? ps->ch : ps->tok;
+
+    switch (op) {
+        case TOK_EQ: case TOK_NE: case TOK_LE: case TOK_GE: case '<': case '>':
+            next(ps);
+            rhs = expr(ps, 0);
+            break;
+        default:
+            c.cond = COND_NE;
+            c.a = lhs;
+            c.b = imm(0);
+            return c;
+    }
+    switch (op) {
+        case TOK_EQ: c.cond = COND_EQ; c.a = lhs; c.b = rhs; break;
+        case TOK_NE: c.cond = COND_NE; c.a = lhs; c.b = rhs; break;
+        case '<': c.cond = COND_LT; c.a = lhs; c.b = rhs; break;
+        case TOK_GE: c.cond = COND_GE; c.a = lhs; c.b = rhs; break;
+        case '>': c.cond = COND_LT; c.a = rhs; c.b = lhs; break;
+        case TOK_LE: c.cond = COND_GE; c.a = rhs; c.b = lhs; break;
+    }
+    return c;
+}
+
+static int evalCond(Cond c) {
+    switch (c.cond) {
+        case COND_EQ: return c.a.n == c.b.n;
+        case COND_NE: return c.a.n != c.b.n;
+        case COND_LT: return c.a.n < c.b.n;
+        default: return c.a.n >= c.b.n;
+    }
+}
+
+// jump to label when the condition evaluates to `when`
+static void branch(Parser *ps, Cond c, int when, int label) {
+    if (c.a.kind == VAL_IMM && c.b.kind == VAL_IMM) {
+        if (evalCond(c) == when)
+            emitJump(ps, label);
+        return;
+    }
+    IrInsn insn = {IR_BR, c.cond, -1, c.a, c.b, label};
+    if (!when)
+        insn.cond ^= 1;
+    emit(ps, insn);
+}
+
+static void statement(Parser *ps);
+
+static void block(Parser *ps) {
+    expectChar(ps, '{');
+    while (!isChar(ps, '}')) {
+        if (ps->tok == TOK_EOF)
+            parseError(ps, "unterminated block");
+        statement(ps);
+    }
+    next(ps);
+}
+
+static void assign(Parser *ps, int dst) {
+    int mark = ps->ir->count;
+    IrValue v = expr(ps, 0);
+    IrProgram *ir = ps->ir;
+
+    // retarget the instruction that produced a fresh temporary
+    if (v.kind == VAL_VREG && ir->names[v.n] == NULL && ir->count > mark &&
+            ir->code[ir->count - 1].dst == v.n) {
+        ir->code[ir->count - 1].dst = dst;
+        return;
+    }
+    IrInsn insn = {IR_COPY, 0, dst, v, {0}, -1};
+    emit(ps, insn);
+}
+
+static void ifStatement(Parser *ps) {
+    int elseLabel = newLabel(ps);
+    next(ps);
+    expectChar(ps, '(');
+    Cond c = condition(ps);
+    expectChar(ps, ')');
+    branch(ps, c, 0, elseLabel);
+    block(ps);
+    if (ps->tok == TOK_ELSE) {
+        int endLabel = newLabel(ps);
+        next(ps);
+        emitJump(ps, endLabel);
+        emitLabel(ps, elseLabel);
+        if (ps->tok == TOK_IF)
+            ifStatement(ps);
+        else
+            block(ps);
+        emitLabel(ps, endLabel);
+    } else {
+        emitLabel(ps, elseLabel);
+    }
+}
+
+static void statement(Parser *ps) {
+    switch (ps->tok) {
+        case TOK_VAR:
+            {
+            next(ps);
+            if (ps->tok != TOK_IDENT)
+                parseError(ps, "expected variable name");
+            if (lookupVar(ps, ps->ident) >= 0)
+                parseError(ps, "variable '%s' already declared", ps->ident);
+            char name[64];
+            strcpy(name, ps->ident);
+            next(ps);
+            expectChar(ps, '=');
+            assign(ps, newVreg(ps, name));
+            expectChar(ps, ';');
+            }
+            break;
+        case TOK_IDENT:
+            {
+            int v = lookupVar(ps, ps->ident);
+            if (v < 0)
+                parseError(ps, "undeclared variable '%s'", ps->ident);
+            next(ps);
+            expectChar(ps, '=');
+            assign(ps, v);
+            expectChar(ps, ';');
+            }
+            break;
+        case TOK_OUT:
+            {
+            next(ps);
+            IrInsn insn = {IR_OUT, 0, -1, expr(ps, 0), {0}, -1};
+            emit(ps, insn);
+            expectChar(ps, ';');
+            }
+            break;
+        case TOK_HALT:
+            {
+            IrInsn insn = {IR_HALT, 0, -1, {0}, {0}, -1};
+            next(ps);
+            emit(ps, insn);
+            expectChar(ps, ';');
+            }
+            break;
+        case TOK_IF:
+            ifStatement(ps);
+            break;
+        case TOK_WHILE:
+            {
+            // rotated loop: one conditional branch per iteration
+            int bodyLabel = newLabel(ps);
+            int testLabel = newLabel(ps);
+            next(ps);
+            expectChar(ps, '(');
+            const char *condStart = ps->p;
+            int condLine = ps->line;
+            int condTok = ps->tok, condCh = ps->ch, condNum = ps->num;
+            char condIdent[64];
+            strcpy(condIdent, ps->ident);
+
+            // skip the condition now and parse it again after the body
+            int depth = 1;
+            while (depth > 0) {
+                if (ps->tok == TOK_EOF)
+                    parseError(ps, "unterminated while condition");
+                if (isChar(ps, '(')) depth++;
+                if (isChar(ps, ')')) depth--;
+                if (depth > 0)
+                    next(ps);
+            }
+            next(ps);
+            emitJump(ps, testLabel);
+            emitLabel(ps, bodyLabel);
+            block(ps);
+
+            const char *resume = ps->p;
+            int resumeLine = ps->line;
+            int resumeTok = ps->tok, resumeCh = ps->ch, resumeNum = ps->num;
+            char resumeIdent[64];
+            strcpy(resumeIdent, ps->ident);
+
+            ps->p = condStart;
+            ps->line = condLine;
+            ps->tok = condTok;
+            ps->ch = condCh;
+            ps->num = condNum;
+            strcpy(ps->ident, condIdent);
+            emitLabel(ps, testLabel);
+            Cond c = condition(ps);
+            branch(ps, c, 1, bodyLabel);
+
+            ps->p = resume;
+            ps->line = resumeLine;
+            ps->tok = resumeTok;
+            ps->ch = resumeCh;
+            ps->num = resumeNum;
+            strcpy(ps->ident, resumeIdent);
+            }
+            break;
+        default:
+            parseError(ps, "expected statement");
+    }
+}
+
+int sclParse(const char *source, IrProgram *ir, char *err, size_t errlen) {
+    Parser ps;
+    memset(&ps, 0, sizeof(ps));
+    memset(ir, 0, sizeof(*ir));
+    ps.src = source;
+    ps.p = source;
+    ps.line = 1;
+    ps.ir = ir;
+    ps.err = err;
+    ps.errlen = errlen;
+
+    if (setjmp(ps.fail)) {
+        irFree(ir);
+        return -1;
+    }
+    next(&ps);
+    while (ps.tok != TOK_EOF)
+        statement(&ps);
+
+    IrInsn halt = {IR_HALT, 0, -1, {0}, {0}, -1};
+    emit(&ps, halt);
+    return 0;
+}
+
+void irFree(IrProgram *ir) {
+    int i;
+    for (i = 0; i < ir->vregs; i++)
+        free(ir->names[i]);
+    free(ir->names);
+    free(ir->code);
+    memset(ir, 0, sizeof(*ir));
+}
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "8080.h"
+#include "scl.h"
+
+// register bits used for liveness; bit n is 8080 register number n
+enum {
+    R_B = 0x001,
+    R_C = 0x002,
+    R_D = 0x004,
+    R_E = 0x008,
+    R_H = 0x010,
+    R_L = 0x020,
+    R_A = 0x080,
+    R_F = 0x100,
+    R_ALL = 0x1bf,
+};
+
+enum {
+    FLOW_NEXT = 0,
+    FLOW_JUMP,
+    FLOW_BRANCH,
+    FLOW_STOP,
+    FLOW_UNKNOWN,
+};
+
+typedef struct Effect {
+    uint16_t use;
+    uint16_t def;
+    uint8_t pure;       // can be deleted when nothing it defines is live
+    uint8_t flow;
+} Effect;
+
+static uint16_t regBit(int r) {
+    if (r == 6)
+        return 0;
+    return r == 7 ? R_A : 1 << r;
+}
+
+static uint16_t pairBits(int p) {
+    static const uint16_t pairs[] = {R_B | R_C, R_D | R_E, R_H | R_L, 0};
+    return pairs[p];
+}
+
+// flags only partially written (CY alone, or everything but CY) count as
+// both used and defined
+static Effect effects(uint16_t opcode) {
+    Effect e = {0, 0, 0, FLOW_NEXT};
+    int y = (opcode >> 3) & 7;
+    int z = opcode & 7;
+    int p = (opcode >> 4) & 3;
+
+    if (opcode == ASM_LABEL) {
+        e.pure = 0;
+        return e;
+    }
+    if (opcode == 0x76) {
+        e.flow = FLOW_STOP;
+        return e;
+    }
+    if (opcode >= 0x40 && opcode < 0x80) {                      // MOV
+        e.use = z == 6 ? R_H | R_L : regBit(z);
+        if (y == 6)
+            e.use |= R_H | R_L;
+        e.def = regBit(y);
+        e.pure = (y != 6);
+        return e;
+    }
+    if (opcode >= 0x80 && opcode < 0xc0) {                      // ALU r
+        e.use = R_A | (z == 6 ? R_H | R_L : regBit(z));
+        if (y == 1 || y == 3)
+            e.use |= R_F;
+        e.def = R_F | (y == 7 ? 0 : R_A);
+        e.pure = 1;
+        return e;
+    }
+    if ((opcode & 0xc7) == 0xc6) {                              // ALU byte
+        e.use = R_A | ((y == 1 || y == 3) ? R_F : 0);
+        e.def = R_F | (y == 7 ? 0 : R_A);
+        e.pure = 1;
+        return e;
+    }
+    if (opcode < 0x40) {
+        switch (z) {
+            case 6:                                             // MVI
+                e.use = y == 6 ? R_H | R_L : 0;
+                e.def = regBit(y);
+                e.pure = (y != 6);
+                return e;
+            case 4: case 5:                                     // INR, DCR
+                e.use = (y == 6 ? R_H | R_L : regBit(y)) | R_F;
+                e.def = regBit(y) | R_F;
+                e.pure = (y != 6);
+                return e;
+            case 3:                                             // INX, DCX
+                e.use = e.def = pairBits(p);
+                e.pure = (p != 3);
+                return e;
+            case 1:
+                if (opcode & 0x08) {                            // DAD
+                    e.use = R_H | R_L | pairBits(p) | R_F;
+                    e.def = R_H | R_L | R_F;
+                    e.pure = 1;
+                } else {                                        // LXI
+                    e.def = pairBits(p);
+                    e.pure = (p != 3);
+                }
+                return e;
+        }
+        switch (opcode) {
+            case 0x00: e.pure = 1; return e;                    // NOP
+            case 0x02: case 0x12: e.use = R_A | pairBits(p); return e;
+            case 0x0a: case 0x1a: e.use = pairBits(p); e.def = R_A; e.pure = 1; return e;
+            case 0x22: e.use = R_H | R_L; return e;
+            case 0x2a: e.def = R_H | R_L; e.pure = 1; return e;
+            case 0x32: e.use = R_A; return e;
+            case 0x3a: e.def = R_A; e.pure = 1; return e;
+            case 0x2f: e.use = e.def = R_A; e.pure = 1; return e;
+            case 0x07: case 0x0f: case 0x17: case 0x1f: case 0x27:
+                e.use = e.def = R_A | R_F;
+                e.pure = 1;
+                return e;
+            case 0x37: case 0x3f: e.use = e.def = R_F; e.pure = 1; return e;
+        }
+    }
+    switch (opcode) {
+        case 0xc3: e.flow = FLOW_JUMP; return e;
+        case 0xd3: e.use = R_A; return e;                       // OUT
+        case 0xdb: e.def = R_A; return e;                       // IN
+        case 0xeb:                                              // XCHG
+            e.use = e.def = R_D | R_E | R_H | R_L;
+            e.pure = 1;
+            return e;
+        case 0xe3: e.use = e.def = R_H | R_L; return e;         // XTHL
+        case 0xf9: e.use = R_H | R_L; return e;                 // SPHL
+        case 0xf3: case 0xfb: return e;                         // DI, EI
+    }
+    if ((opcode & 0xc7) == 0xc2) {                              // Jcc
+        e.use = R_F;
+        e.flow = FLOW_BRANCH;
+        return e;
+    }
+    if ((opcode & 0xcf) == 0xc5) {                              // PUSH
+        e.use = p == 3 ? R_A | R_F : pairBits(p);
+        return e;
+    }
+    if ((opcode & 0xcf) == 0xc1) {                              // POP
+        e.def = p == 3 ? R_A | R_F : pairBits(p);
+        return e;
+    }
+    e.use = e.def = R_ALL;
+    e.flow = FLOW_UNKNOWN;
+    return e;
+}
+
+// registers live after each instruction
+static uint16_t *liveOut(const AsmProgram *prog) {
+    int n = prog->count;
+    uint16_t *out = calloc(n + 1, sizeof(uint16_t));
+    uint16_t *in = calloc(n + 1, sizeof(uint16_t));
+    int *labelAt = malloc((prog->labels + 1) * sizeof(int));
+    int i, changed;
+
+    for (i = 0; i < n; i++) {
+        if (prog->code[i].opcode == ASM_LABEL)
+            labelAt[prog->code[i].label] = i;
+    }
+
+    do {
+        changed = 0;
+        for (i = n - 1; i >= 0; i--) {
+            const AsmInsn *insn = &prog->code[i];
+            Effect e = effects(insn->opcode);
+            uint16_t live = 0;
+
+            switch (e.flow) {
+                case FLOW_NEXT: live = in[i + 1]; break;
+                case FLOW_JUMP: live = in[labelAt[insn->label]]; break;
+                case FLOW_BRANCH: live = in[i + 1] | in[labelAt[insn->label]]; break;
+                case FLOW_STOP: live = 0; break;
+                case FLOW_UNKNOWN: live = R_ALL; break;
+            }
+            if (e.flow == FLOW_JUMP && insn->label < 0)
+                live = R_ALL;
+            uint16_t li = (live & ~e.def) | e.use;
+            if (out[i] != live || in[i] != li) {
+                out[i] = live;
+                in[i] = li;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    free(in);
+    free(labelAt);
+    return out;
+}
+
+// replace code[i..i+n) with repl[0..m) if that saves cycles
+static int replaceIfCheaper(AsmProgram *prog, int i, int n, const AsmInsn *repl, int m) {
+    if (asmCycles(repl, m) >= asmCycles(&prog->code[i], n))
+        return 0;
+    if (m > n && prog->count + (m - n) > prog->cap) {
+        prog->cap = prog->count + (m - n) + 16;
+        prog->code = realloc(prog->code, prog->cap * sizeof(AsmInsn));
+    }
+    memmove(&prog->code[i + m], &prog->code[i + n], (prog->count - i - n) * sizeof(AsmInsn));
+    memcpy(&prog->code[i], repl, m * sizeof(AsmInsn));
+    prog->count += m - n;
+    return 1;
+}
+
+static AsmInsn op(uint16_t opcode, uint16_t operand) {
+    AsmInsn insn = {opcode, operand, -1};
+    return insn;
+}
+
+static int isMov(const AsmInsn *insn, int dst, int src) {
+    return insn->opcode == (0x40 | (dst << 3) | src);
+}
+
+// does `label` sit among the labels directly after instruction i
+static int labelFollows(const AsmProgram *prog, int i, int label) {
+    int j;
+    for (j = i + 1; j < prog->count && prog->code[j].opcode == ASM_LABEL; j++) {
+        if (prog->code[j].label == label)
+            return 1;
+    }
+    return 0;
+}
+
+// rewrites that only need local context and liveness
+static int rewriteAt(AsmProgram *prog, int i, const uint16_t *live) {
+    AsmInsn *c = &prog->code[i];
+    int rest = prog->count - i;
+    Effect e = effects(c->opcode);
+    AsmInsn repl[2];
+
+    // dead instruction, or a move of a register onto itself
+    if (e.pure && (e.def & live[i]) == 0)
+        return replaceIfCheaper(prog, i, 1, repl, 0);
+    if (c->opcode >= 0x40 && c->opcode < 0x80 && c->opcode != 0x76 &&
+            ((c->opcode >> 3) & 7) == (c->opcode & 7))
+        return replaceIfCheaper(prog, i, 1, repl, 0);
+
+    // JMP to the very next instruction
+    if (c->opcode == 0xc3 && c->label >= 0 && labelFollows(prog, i, c->label))
+        return replaceIfCheaper(prog, i, 1, repl, 0);
+
+    // Jcc L1; JMP L2; L1:  ->  J!cc L2
+    if ((c->opcode & 0xc7) == 0xc2 && rest >= 3 && prog->code[i + 1].opcode == 0xc3 &&
+            prog->code[i + 1].label >= 0 && c->label >= 0 && labelFollows(prog, i + 1, c->label)) {
+        repl[0] = prog->code[i + 1];
+        repl[0].opcode = c->opcode ^ 0x08;
+        return replaceIfCheaper(prog, i, 2, repl, 1);
+    }
+
+    // CPI 0 -> ORA A; the compiler never reads AC
+    if (c->opcode == 0xfe && c->operand == 0) {
+        repl[0] = op(0xb7, 0);
+        return replaceIfCheaper(prog, i, 1, repl, 1);
+    }
+
+    // MVI A,0 -> XRA A when the flags it clobbers are dead
+    if (c->opcode == 0x3e && c->operand == 0 && !(live[i] & R_F)) {
+        repl[0] = op(0xaf, 0);
+        return replaceIfCheaper(prog, i, 1, repl, 1);
+    }
+
+    if (rest >= 2) {
+        AsmInsn *d = &prog->code[i + 1];
+        int r;
+
+        // MOV D,H; MOV E,L -> XCHG when HL is dead afterwards, and the reverse
+        if (((isMov(c, 2, 4) && isMov(d, 3, 5)) || (isMov(c, 3, 5) && isMov(d, 2, 4))) &&
+                !(live[i + 1] & (R_H | R_L))) {
+            repl[0] = op(0xeb, 0);
+            return replaceIfCheaper(prog, i, 2, repl, 1);
+        }
+        if (((isMov(c, 4, 2) && isMov(d, 5, 3)) || (isMov(c, 5, 3) && isMov(d, 4, 2))) &&
+                !(live[i + 1] & (R_D | R_E))) {
+            repl[0] = op(0xeb, 0);
+            return replaceIfCheaper(prog, i, 2, repl, 1);
+        }
+
+        // MOV r,A; MOV A,r  or  MOV A,r; MOV r,A: the second move is a no-op
+        for (r = 0; r < 6; r++) {
+            if ((isMov(c, r, 7) && isMov(d, 7, r)) || (isMov(c, 7, r) && isMov(d, r, 7))) {
+                repl[0] = *c;
+                return replaceIfCheaper(prog, i, 2, repl, 1);
+            }
+        }
+    }
+
+    // MOV A,r; ADI 1; MOV r,A  ->  INR r   (SUI 1 -> DCR r)
+    // MVI A,1; ADD r; MOV r,A  ->  INR r
+    if (rest >= 3 && !(live[i + 2] & (R_A | R_F))) {
+        AsmInsn *d = &prog->code[i + 1];
+        int r;
+        for (r = 0; r < 6; r++) {
+            if (!isMov(&prog->code[i + 2], r, 7))
+                continue;
+            if (isMov(c, 7, r) && (d->opcode == 0xc6 || d->opcode == 0xd6) && d->operand == 1) {
+                repl[0] = op((d->opcode == 0xc6 ? 0x04 : 0x05) | (r << 3), 0);
+                return replaceIfCheaper(prog, i, 3, repl, 1);
+            }
+            if (c->opcode == 0x3e && c->operand == 1 && d->opcode == (0x80 | r)) {
+                repl[0] = op(0x04 | (r << 3), 0);
+                return replaceIfCheaper(prog, i, 3, repl, 1);
+            }
+        }
+    }
+    return 0;
+}
+
+// track the constant held in HL to turn LXI H into INX/DCX H or nothing,
+// and LDA/STA of that address into MOV A,M / MOV M,A
+static int rewriteHL(AsmProgram *prog) {
+    int known = 0;
+    uint16_t hl = 0;
+    int i;
+
+    for (i = 0; i < prog->count; i++) {
+        AsmInsn *c = &prog->code[i];
+        AsmInsn repl[1];
+
+        if (known && c->label < 0) {
+            if (c->opcode == 0x21) {
+                if (c->operand == hl && replaceIfCheaper(prog, i, 1, repl, 0))
+                    return 1;
+                repl[0] = op(c->operand == (uint16_t) (hl + 1) ? 0x23 : 0x2b, 0);
+                if ((c->operand == (uint16_t) (hl + 1) || c->operand == (uint16_t) (hl - 1)) &&
+                        replaceIfCheaper(prog, i, 1, repl, 1))
+                    return 1;
+            }
+            if ((c->opcode == 0x3a || c->opcode == 0x32) && c->operand == hl) {
+                repl[0] = op(c->opcode == 0x3a ? 0x7e : 0x77, 0);
+                if (replaceIfCheaper(prog, i, 1, repl, 1))
+                    return 1;
+            }
+        }
+
+        Effect e = effects(c->opcode);
+        if (c->opcode == 0x21 && c->label < 0) {
+            known = 1;
+            hl = c->operand;
+        } else if (e.flow != FLOW_NEXT || c->opcode == ASM_LABEL || (e.def & (R_H | R_L))) {
+            known = 0;
+        }
+    }
+    return 0;
+}
+
+int sclPeephole(AsmProgram *prog) {
+    int rewrites = 0;
+    int progress;
+
+    do {
+        uint16_t *live = liveOut(prog);
+        int i;
+        progress = 0;
+        for (i = 0; i < prog->count && !progress; i++)
+            progress = rewriteAt(prog, i, live);
+        free(live);
+        if (!progress)
+            progress = rewriteHL(prog);
+        rewrites += progress;
+    } while (progress);
+
+    return rewrites;
+}
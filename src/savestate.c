@@ -0,0 +1,296 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "hash.h"
+#include "savestate.h"
+
+#define PAGE_SIZE 256
+
+// PackBits: n < 128 is followed by n+1 literals, n > 128 repeats the next
+// byte 257-n times. Returns the encoded length or -1 if it isn't smaller.
+static int rleEncode(const uint8_t *page, uint8_t *out) {
+    int i = 0, len = 0;
+    while (i < PAGE_SIZE) {
+        int run = 1;
+        while (i + run < PAGE_SIZE && run < 128 && page[i + run] == page[i])
+            run++;
+        if (run >= 3) {
+            if (len + 2 >= PAGE_SIZE)
+                return -1;
+            out[len++] = 257 - run;
+            out[len++] = page[i];
+            i += run;
+            continue;
+        }
+
+        // literals up to the next run of three
+        int start = i;
+        while (i < PAGE_SIZE && i - start < 128) {
+            if (i + 2 < PAGE_SIZE && page[i] == page[i + 1] && page[i] == page[i + 2])
+                break;
+            i++;
+        }
+        if (len + 1 + (i - start) >= PAGE_SIZE)
+            return -1;
+        out[len++] = i - start - 1;
+        memcpy(&out[len], &page[start], i - start);
+        len += i - start;
+    }
+    return len;
+}
+
+// out may be NULL to only check the data decodes to exactly one page
+static int rleDecode(const uint8_t *in, int len, uint8_t *out) {
+    int i = 0, pos = 0;
+    while (i < len) {
+        uint8_t n = in[i++];
+        if (n < 128) {
+            if (i + n + 1 > len || pos + n + 1 > PAGE_SIZE)
+                return -1;
+            if (out)
+                memcpy(&out[pos], &in[i], n + 1);
+            i += n + 1;
+            pos += n + 1;
+        } else if (n > 128) {
+            if (i >= len || pos + 257 - n > PAGE_SIZE)
+                return -1;
+            if (out)
+                memset(&out[pos], in[i], 257 - n);
+            i++;
+            pos += 257 - n;
+        }
+    }
+    return pos == PAGE_SIZE ? 0 : -1;
+}
+
+// the header is used in place, so files are only written and read on
+// little-endian hosts
+static int littleEndian(void) {
+    const uint16_t one = 1;
+    return *(const uint8_t *) &one;
+}
+
+long saveState(State* state, uint32_t rom_size, const void *device, uint32_t device_size,
+        uint8_t *out, char *err, size_t errlen) {
+    SaveHeader *header = (SaveHeader *) out;
+    uint32_t offset = sizeof(SaveHeader);
+    int page;
+
+    if (!littleEndian()) {
+        snprintf(err, errlen, "save states need a little-endian host");
+        return -1;
+    }
+    if (rom_size > 0x10000 || rom_size % PAGE_SIZE) {
+        snprintf(err, errlen, "rom size $%x is not a whole number of pages", rom_size);
+        return -1;
+    }
+    if (device_size > SAVE_DEVICE_MAX) {
+        snprintf(err, errlen, "device state of %u bytes exceeds %d", device_size, SAVE_DEVICE_MAX);
+        return -1;
+    }
+
+    memset(header, 0, sizeof(SaveHeader));
+    memcpy(header->magic, SAVE_MAGIC, 4);
+    header->version = SAVE_VERSION;
+    header->header_size = sizeof(SaveHeader);
+    header->rom_checksum = memoryChecksum(state, 0, rom_size);
+    header->rom_size = rom_size;
+    header->a = state->a;
+    header->b = state->b;
+    header->c = state->c;
+    header->d = state->d;
+    header->e = state->e;
+    header->h = state->h;
+    header->l = state->l;
+    header->flags = state->cc.z | state->cc.s << 1 | state->cc.p << 2 |
+            state->cc.cy << 3 | state->cc.ac << 4;
+    header->sp = state->sp;
+    header->pc = state->pc;
+    header->int_enable = state->int_enable;
+    header->cycles = state->cycles;
+    header->device_size = device_size;
+    if (device_size)
+        memcpy(header->device, device, device_size);
+
+    for (page = rom_size / PAGE_SIZE; page < 256; page++) {
+        SavePage *p = &header->pages[page];
+        uint8_t bytes[PAGE_SIZE];
+        int i, zero = 1;
+        for (i = 0; i < PAGE_SIZE; i++) {
+            bytes[i] = memoryPeek(state, (page << 8) | i);
+            zero &= bytes[i] == 0;
+        }
+
+        p->offset = offset;
+        if (zero) {
+            p->encoding = SAVE_PAGE_ZERO;
+            continue;
+        }
+        int len = rleEncode(bytes, &out[offset]);
+        if (len < 0) {
+            memcpy(&out[offset], bytes, PAGE_SIZE);
+            len = PAGE_SIZE;
+            p->encoding = SAVE_PAGE_RAW;
+        } else {
+            p->encoding = SAVE_PAGE_RLE;
+        }
+        p->length = len;
+        offset += len;
+    }
+    header->file_size = offset;
+    return offset;
+}
+
+int saveStateFile(State* state, const char *filename, uint32_t rom_size, const void *device,
+        uint32_t device_size, char *err, size_t errlen) {
+    static uint8_t buffer[SAVE_STATE_MAX];
+    long size = saveState(state, rom_size, device, device_size, buffer, err, errlen);
+    if (size < 0)
+        return -1;
+
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        snprintf(err, errlen, "error opening file: %s", filename);
+        return -1;
+    }
+    size_t written = fwrite(buffer, size, 1, f);
+    if (fclose(f) != 0 || written != 1) {
+        snprintf(err, errlen, "error writing file: %s", filename);
+        return -1;
+    }
+    return 0;
+}
+
+static int checkState(State* state, const SaveHeader *header, size_t size, char *err, size_t errlen) {
+    const uint8_t *data = (const uint8_t *) header;
+    int page;
+
+    if (size < sizeof(SaveHeader) || memcmp(header->magic, SAVE_MAGIC, 4) != 0) {
+        snprintf(err, errlen, "not a save state");
+        return -1;
+    }
+    if (!littleEndian() || header->version == SAVE_VERSION << 8) {
+        snprintf(err, errlen, "save state is not little-endian");
+        return -1;
+    }
+    if (header->version != SAVE_VERSION || header->header_size != sizeof(SaveHeader)) {
+        snprintf(err, errlen, "unsupported save state version %d (expected %d)",
+                header->version, SAVE_VERSION);
+        return -1;
+    }
+    if (header->file_size > size || header->rom_size > 0x10000 || header->rom_size % PAGE_SIZE ||
+            header->device_size > SAVE_DEVICE_MAX) {
+        snprintf(err, errlen, "corrupt save state header");
+        return -1;
+    }
+    if (memoryChecksum(state, 0, header->rom_size) != header->rom_checksum) {
+        snprintf(err, errlen, "ROM checksum mismatch: save state wants %08x", header->rom_checksum);
+        return -1;
+    }
+
+    for (page = header->rom_size / PAGE_SIZE; page < 256; page++) {
+        const SavePage *p = &header->pages[page];
+        int ok;
+        switch (p->encoding) {
+            case SAVE_PAGE_ZERO:
+                ok = 1;
+                break;
+            case SAVE_PAGE_RAW:
+                ok = p->length == PAGE_SIZE && p->offset <= header->file_size &&
+                        PAGE_SIZE <= header->file_size - p->offset;
+                break;
+            case SAVE_PAGE_RLE:
+                // written so a huge offset can't wrap past the check
+                ok = p->offset <= header->file_size && p->length <= header->file_size - p->offset &&
+                        rleDecode(&data[p->offset], p->length, NULL) == 0;
+                break;
+            default:
+                ok = 0;
+        }
+        if (!ok) {
+            snprintf(err, errlen, "corrupt save state page $%02x", page);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int loadState(State* state, const void *data, size_t size, void *device, uint32_t device_cap,
+        char *err, size_t errlen) {
+    const SaveHeader *header = data;
+    const uint8_t *bytes = data;
+    int page;
+
+    if (checkState(state, header, size, err, errlen) != 0)
+        return -1;
+    // a shorter block would restore only a prefix of the device state
+    if (device && header->device_size != device_cap) {
+        snprintf(err, errlen, "device state is %u bytes, expected %u", header->device_size, device_cap);
+        return -1;
+    }
+
+    disarmBreakpoints(state);
+    for (page = header->rom_size / PAGE_SIZE; page < 256; page++) {
+        const SavePage *p = &header->pages[page];
+        uint8_t *dst = &state->memory[page << 8];
+        if (p->encoding == SAVE_PAGE_ZERO)
+            memset(dst, 0, PAGE_SIZE);
+        else if (p->encoding == SAVE_PAGE_RAW)
+            memcpy(dst, &bytes[p->offset], PAGE_SIZE);
+        else
+            rleDecode(&bytes[p->offset], p->length, dst);
+    }
+    armBreakpoints(state);
+
+    state->a = header->a;
+    state->b = header->b;
+    state->c = header->c;
+    state->d = header->d;
+    state->e = header->e;
+    state->h = header->h;
+    state->l = header->l;
+    state->cc.z = (header->flags & 0x01) != 0;
+    state->cc.s = (header->flags & 0x02) != 0;
+    state->cc.p = (header->flags & 0x04) != 0;
+    state->cc.cy = (header->flags & 0x08) != 0;
+    state->cc.ac = (header->flags & 0x10) != 0;
+    state->sp = header->sp;
+    state->pc = header->pc;
+    state->int_enable = header->int_enable;
+    state->cycles = header->cycles;
+    state->stop_reason = STOP_NONE;
+    if (device)
+        memcpy(device, header->device, header->device_size);
+    if (state->hash)
+        hashReset(state);
+    return 0;
+}
+
+const void *mapStateFile(const char *filename, size_t *size, char *err, size_t errlen) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(err, errlen, "error opening file: %s", filename);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        snprintf(err, errlen, "error mapping file: %s", filename);
+        return NULL;
+    }
+    *size = st.st_size;
+    return data;
+}
+
+void unmapStateFile(const void *data, size_t size) {
+    munmap((void *) data, size);
+}
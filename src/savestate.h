@@ -0,0 +1,73 @@
+#ifndef SCL_SAVESTATE_H
+#define SCL_SAVESTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "8080.h"
+
+#define SAVE_MAGIC "SCLS"
+#define SAVE_VERSION 1
+#define SAVE_DEVICE_MAX 64
+
+// how a page of memory is stored in the file
+enum {
+    SAVE_PAGE_ROM = 0,      // not stored, covered by rom_checksum
+    SAVE_PAGE_ZERO = 1,     // all zero, not stored
+    SAVE_PAGE_RAW = 2,      // 256 bytes as is
+    SAVE_PAGE_RLE = 3,      // PackBits
+};
+
+typedef struct SavePage {
+    uint32_t offset;        // from the start of the file
+    uint16_t length;
+    uint8_t encoding;
+    uint8_t pad;
+} SavePage;
+
+// Fixed-size, naturally aligned, little-endian header followed by the page
+// data, so a mapped file can be restored in place without parsing. Any
+// layout change must bump SAVE_VERSION.
+typedef struct SaveHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t file_size;
+    uint32_t rom_checksum;  // CRC-32 of memory below rom_size
+    uint32_t rom_size;      // multiple of 256
+    uint8_t a, b, c, d, e, h, l;
+    uint8_t flags;          // PUSH PSW layout
+    uint16_t sp;
+    uint16_t pc;
+    uint8_t int_enable;
+    uint8_t pad[3];
+    uint32_t device_size;
+    uint64_t cycles;
+    uint8_t device[SAVE_DEVICE_MAX];    // shift register, port latches, ...
+    SavePage pages[256];
+} SaveHeader;
+
+_Static_assert(sizeof(SaveHeader) == 2160, "save-state header layout changed");
+
+// worst case: every page stored raw
+#define SAVE_STATE_MAX (sizeof(SaveHeader) + 0x10000)
+
+// write the machine into out (at least SAVE_STATE_MAX bytes); pages below
+// rom_size are referenced by checksum only. device is opaque state owned by
+// the I/O layer. Returns the size written or -1 with a message in err.
+long saveState(State* state, uint32_t rom_size, const void *device, uint32_t device_size,
+        uint8_t *out, char *err, size_t errlen);
+int saveStateFile(State* state, const char *filename, uint32_t rom_size, const void *device,
+        uint32_t device_size, char *err, size_t errlen);
+
+// restore from a save state in memory. The ROM must already be loaded and
+// match the checksum. device (device_cap bytes, may be NULL) receives the
+// device block, which must be exactly device_cap bytes. Nothing is changed
+// if the data is rejected.
+int loadState(State* state, const void *data, size_t size, void *device, uint32_t device_cap,
+        char *err, size_t errlen);
+
+const void *mapStateFile(const char *filename, size_t *size, char *err, size_t errlen);
+void unmapStateFile(const void *data, size_t size);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scheduler.h"
+
+static Scheduler *schedulerFor(State* state) {
+    if (state->scheduler == NULL)
+        state->scheduler = calloc(1, sizeof(Scheduler));
+    return state->scheduler;
+}
+
+// a before b means a fires later
+static int later(const Event *a, const Event *b) {
+    return a->when != b->when ? a->when > b->when : a->seq > b->seq;
+}
+
+static void insert(Scheduler *s, const Event *e) {
+    int i = s->count++;
+    while (i > 0 && later(e, &s->events[i - 1])) {
+        s->events[i] = s->events[i - 1];
+        i--;
+    }
+    s->events[i] = *e;
+}
+
+int scheduleEvent(State* state, uint64_t when, uint32_t period, EventFn fn, void *ctx) {
+    Scheduler *s = schedulerFor(state);
+    Event e;
+    if (s->count == MAX_EVENTS)
+        return -1;
+    e.when = when;
+    e.period = period;
+    e.seq = s->next_seq++;
+    e.id = s->next_id++;
+    e.fn = fn;
+    e.ctx = ctx;
+    insert(s, &e);
+    return e.id;
+}
+
+int cancelEvent(State* state, int id) {
+    Scheduler *s = state->scheduler;
+    int i;
+    for (i = 0; s && i < s->count; i++) {
+        if (s->events[i].id == id) {
+            memmove(&s->events[i], &s->events[i + 1], (s->count - i - 1) * sizeof(Event));
+            s->count--;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void fireEvents(State* state) {
+    Scheduler *s = state->scheduler;
+    while (s && s->count && s->events[s->count - 1].when <= state->cycles) {
+        Event e = s->events[--s->count];
+        // requeue first so the callback can cancel or reschedule it
+        if (e.period) {
+            Event next = e;
+            next.when += e.period;
+            insert(s, &next);
+        }
+        e.fn(state, e.ctx);
+    }
+}
+
+int runScheduled(State* state) {
+    const Scheduler *s = state->scheduler;
+    uint64_t deadline = s && s->count ? s->events[s->count - 1].when : UINT64_MAX;
+    while (state->cycles < deadline) {
+        int stop = Emulate8080(state);
+        if (stop != STOP_NONE)
+            return stop;
+    }
+    fireEvents(state);
+    return STOP_NONE;
+}
+
+void interruptEvent(State* state, void *ctx) {
+    generateInterrupt(state, (int) (intptr_t) ctx);
+}
@@ -0,0 +1,44 @@
+#ifndef SCL_SCHEDULER_H
+#define SCL_SCHEDULER_H
+
+#include <stdint.h>
+
+#include "8080.h"
+
+#define MAX_EVENTS 16
+
+typedef void (*EventFn)(State* state, void *ctx);
+
+typedef struct Event {
+    uint64_t when;          // absolute state->cycles
+    uint32_t period;        // 0 for one-shot
+    uint32_t seq;           // registration order, breaks ties
+    int id;
+    EventFn fn;
+    void *ctx;
+} Event;
+
+// sorted latest first, so the next event is always the last entry
+struct Scheduler {
+    Event events[MAX_EVENTS];
+    int count;
+    int next_id;
+    uint32_t next_seq;
+};
+
+// call fn at cycle `when` and then every `period` cycles if nonzero.
+// Returns an id for cancelEvent, or -1 if the queue is full.
+int scheduleEvent(State* state, uint64_t when, uint32_t period, EventFn fn, void *ctx);
+int cancelEvent(State* state, int id);
+
+// fire everything due at state->cycles, in deadline then registration order
+void fireEvents(State* state);
+
+// run straight to the next deadline with no device checks in between, then
+// fire the due events. Returns the stop reason if Emulate8080 stops first.
+int runScheduled(State* state);
+
+// RST n as an event, ctx is the RST number; masked while interrupts are off
+void interruptEvent(State* state, void *ctx);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SCL_SCL_H
+#define SCL_SCL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// spilled variables live here; the generated code itself starts at the origin
+#define SCL_DATA_BASE 0x2000
+
+// IR opcodes
+enum {
+    IR_COPY = 0,    // dst = a
+    IR_ADD,         // dst = a + b
+    IR_SUB,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_OUT,         // out a
+    IR_LABEL,       // label:
+    IR_JMP,         // goto label
+    IR_BR,          // if (a cond b) goto label
+    IR_HALT,
+};
+
+// branch conditions, all unsigned
+enum {
+    COND_EQ = 0,
+    COND_NE,
+    COND_LT,
+    COND_GE,
+};
+
+enum {
+    VAL_NONE = 0,
+    VAL_VREG,
+    VAL_IMM,
+};
+
+typedef struct IrValue {
+    uint8_t kind;
+    uint16_t n;         // vreg number or immediate
+} IrValue;
+
+typedef struct IrInsn {
+    uint8_t op;
+    uint8_t cond;
+    int dst;
+    IrValue a;
+    IrValue b;
+    int label;
+} IrInsn;
+
+typedef struct IrProgram {
+    IrInsn *code;
+    int count;
+    int cap;
+    int vregs;
+    int labels;
+    char **names;       // variable name per vreg, NULL for temporaries
+} IrProgram;
+
+// pseudo opcode marking a label position in an AsmProgram
+#define ASM_LABEL 0x100
+
+typedef struct AsmInsn {
+    uint16_t opcode;
+    uint16_t operand;
+    int label;          // jump target or label id, -1 if unused
+} AsmInsn;
+
+typedef struct AsmProgram {
+    AsmInsn *code;
+    int count;
+    int cap;
+    int labels;
+} AsmProgram;
+
+int sclParse(const char *source, IrProgram *ir, char *err, size_t errlen);
+void irFree(IrProgram *ir);
+
+int sclCodegen(const IrProgram *ir, AsmProgram *out);
+int sclPeephole(AsmProgram *prog);
+
+void asmEmit(AsmProgram *prog, uint16_t opcode, uint16_t operand, int label);
+int asmEncode(const AsmProgram *prog, uint8_t *memory, uint16_t origin);
+void asmPrint(const AsmProgram *prog, FILE *f);
+int asmCycles(const AsmInsn *code, int count);
+void asmFree(AsmProgram *prog);
+
+#endif
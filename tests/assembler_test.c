@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "assembler.h"
+
+static int failures;
+
+// assemble source at 0 and return the result, or -1 with the error in err
+static int check(const char *source, State* state, char *err, size_t errlen) {
+    memset(state->memory, 0, 0x10000);
+    return assemble(state, source, 0, NULL, err, errlen);
+}
+
+static void expect(int ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+int main(void) {
+    State* state = init8080();
+    char err[256];
+
+    // DS with a forward-referenced size would move labels between passes
+    expect(check("JMP after\nDS N\nafter: HLT\nN EQU 4\n", state, err, sizeof(err)) < 0 &&
+            strstr(err, "'N' must be defined") != NULL, "DS rejects a forward reference");
+    expect(check("ORG start\nstart: NOP\n", state, err, sizeof(err)) < 0,
+            "ORG rejects a forward reference");
+    expect(check("N EQU 4\nJMP after\nDS N\nafter: HLT\n", state, err, sizeof(err)) >= 0 &&
+            state->memory[1] == 0x07 && state->memory[2] == 0x00, "DS with a defined size places labels");
+    // the README example: 21 bytes of code and data around a 16-byte DS gap
+    expect(check("start: LXI H,buf\nMVI B,#$10\nloop: MOV M,B\nINX H\nDCR B\nJNZ loop\nHLT\n"
+            "SIZE EQU 16\nbuf: DS SIZE\nDB 'x',\"text\",HIGH(buf),LOW(buf)\nDW start\n",
+            state, err, sizeof(err)) == 37, "the span includes DS gaps");
+    // a ';' inside a string does not start a comment
+    expect(check("DB 'a;b',\"c;d\" ; comment\n", state, err, sizeof(err)) == 6 &&
+            memcmp(state->memory, "a;bc;d", 6) == 0, "strings may contain ';'");
+    // N reads 0 in pass 1 through the EQU, so x moves in pass 2
+    expect(check("JMP x\nN EQU x\nDS N\nx: HLT\n", state, err, sizeof(err)) < 0 &&
+            strstr(err, "phase error") != NULL, "a label that moves between passes is an error");
+
+    free8080(state);
+    printf("%s\n", failures ? "assembler tests failed" : "assembler tests passed");
+    return failures ? 1 : 0;
+}
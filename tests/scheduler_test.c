@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "scheduler.h"
+
+static int failures;
+static char fired[16];
+static int nfired;
+
+static void record(State* state, void *ctx) {
+    (void) state;
+    if (nfired < (int) sizeof(fired) - 1)
+        fired[nfired++] = (char) (intptr_t) ctx;
+}
+
+static void expect(int ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+int main(void) {
+    State* state = init8080();
+
+    // A is registered first but B fires first, so B is requeued first too;
+    // when their deadlines meet at 300 and 500, A must still go first
+    scheduleEvent(state, 200, 100, record, (void *) 'A');
+    scheduleEvent(state, 100, 200, record, (void *) 'B');
+    for (state->cycles = 100; state->cycles <= 500; state->cycles += 100)
+        fireEvents(state);
+    fired[nfired] = 0;
+    expect(strcmp(fired, "BAABAAB") == 0, "periodic events keep their registration order");
+
+    free8080(state);
+    printf("%s\n", failures ? "scheduler tests failed" : "scheduler tests passed");
+    return failures ? 1 : 0;
+}